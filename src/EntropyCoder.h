@@ -0,0 +1,129 @@
+/*
+ * EntropyCoder.h
+ *
+ * Entropy coders that can be built from a block histogram and stored in a block
+ * header of the stream written by HuffmanEncoding::encodeTextMultiTable. Every
+ * coder writes its output as '0'/'1' characters, like the rest of the codec, and
+ * serializes its table in the code file line format.
+ */
+
+#ifndef ENTROPYCODER_H_
+#define ENTROPYCODER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "HuffmanEncoding.h"
+
+class EntropyCoder{
+
+public:
+	virtual ~EntropyCoder() {}
+
+	/**
+	 * Create the coder identified by a block header letter, or NULL if the letter is unknown.
+	 */
+	static EntropyCoder* create(char blockType);
+
+	/**
+	 * Letter identifying the coder in block headers.
+	 */
+	virtual char blockType() const = 0;
+
+	/**
+	 * Build the coder from the histogram of a block and serialize its table.
+	 *
+	 * @param count Number of occurrences of every character, HuffmanCodeTable::NUM_CHARACTERS entries.
+	 * @param blockLength Number of characters in the block, i.e. the sum of count.
+	 * @param serialized Receives the table, one line per entry.
+	 *
+	 * Returns the number of serialized entries.
+	 */
+	virtual int build(const int count[], size_t blockLength, std::string& serialized) = 0;
+
+	/**
+	 * Read a table serialized by build.
+	 */
+	virtual bool parse(const char* text, size_t length) = 0;
+
+	/**
+	 * Number of bits encode would write for a block with the given histogram, or -1 if
+	 * a character of the block cannot be coded. May be an estimate.
+	 */
+	virtual long long estimateBits(const int count[]) const = 0;
+
+	/**
+	 * Append the bits of data to out. Returns false if a character cannot be coded.
+	 */
+	virtual bool encode(const uint8_t* data, size_t size, std::vector<uint8_t>& out) const = 0;
+
+	/**
+	 * Decode numSymbols characters from the bits in data and append them to out.
+	 * Returns the number of bytes of data consumed, or -1 if the bits are invalid or
+	 * run out before numSymbols characters were produced.
+	 */
+	virtual long decode(const uint8_t* data, size_t length, long numSymbols, std::vector<uint8_t>& out) const = 0;
+};
+
+/**
+ * Prefix code built by the Huffman tree, block type 'F'.
+ */
+class HuffmanCoder : public EntropyCoder{
+
+public:
+	char blockType() const { return 'F'; }
+	int build(const int count[], size_t blockLength, std::string& serialized);
+	bool parse(const char* text, size_t length);
+	long long estimateBits(const int count[]) const;
+	bool encode(const uint8_t* data, size_t size, std::vector<uint8_t>& out) const;
+	long decode(const uint8_t* data, size_t length, long numSymbols, std::vector<uint8_t>& out) const;
+
+private:
+	HuffmanCodeTable table;
+};
+
+/**
+ * Table based asymmetric numeral system coder (tANS), block type 'A'. Symbol
+ * probabilities are normalized to a table of 2^tableLog states, so characters cost
+ * fractional bits and skewed histograms get close to their entropy. The table entries
+ * store the normalized counts in place of codes.
+ */
+class TansCoder : public EntropyCoder{
+
+public:
+	static const int MIN_TABLE_LOG = 5;
+	static const int MAX_TABLE_LOG = 12;
+
+	TansCoder();
+
+	char blockType() const { return 'A'; }
+	int build(const int count[], size_t blockLength, std::string& serialized);
+	bool parse(const char* text, size_t length);
+	long long estimateBits(const int count[]) const;
+	bool encode(const uint8_t* data, size_t size, std::vector<uint8_t>& out) const;
+	long decode(const uint8_t* data, size_t length, long numSymbols, std::vector<uint8_t>& out) const;
+
+private:
+	struct DecodeEntry
+	{
+		uint8_t symbol;
+		uint8_t numBits;
+		uint16_t nextStateBase;
+	};
+
+	/**
+	 * Build the encoding and decoding tables from normalized. Returns false if the
+	 * counts do not add up to a power of two within the table log limits.
+	 */
+	bool buildTables();
+
+	int tableLog;
+	int normalized[HuffmanCodeTable::NUM_CHARACTERS];
+	// Encoding: states of every symbol, grouped by symbol in ascending order.
+	int symbolStart[HuffmanCodeTable::NUM_CHARACTERS];
+	int symbolMaxBits[HuffmanCodeTable::NUM_CHARACTERS];
+	std::vector<uint16_t> encodeStates;
+	std::vector<DecodeEntry> decodeTable;
+};
+
+#endif /* ENTROPYCODER_H_ */
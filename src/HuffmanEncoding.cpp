@@ -1,16 +1,30 @@
 #include <cstdio>
 #include "HuffmanEncoding.h"
+#include "EntropyCoder.h"
+#include "HuffmanInternal.h"
+#include "RunLength.h"
+#include "util/MappedFile.h"
+#include "util/StreamPipeline.h"
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <atomic>
 #include <iomanip>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
+
+const int NUM_CHARACTERS = 128; // ASCII range
 
 struct Node
 {
     char character;
-    int count;
+    long long count;
     Node *left;
     Node *right;
 };
-Node *createNode(char character, int count)
+Node *createNode(char character, long long count)
 {
     Node *newNode = new Node();
     newNode->character = character;
@@ -20,7 +34,7 @@ Node *createNode(char character, int count)
     return newNode;
 }
 
-Node *huffmanTree(int characterFrequencies[], int numCharacters)
+Node *huffmanTree(const long long characterFrequencies[], int numCharacters)
 {
     Node *nodes[numCharacters * 2];
     int nodeCount = 0;
@@ -62,45 +76,123 @@ Node *huffmanTree(int characterFrequencies[], int numCharacters)
     return nodes[0];
 }
 
-void traverse(Node *root, std::string code, FILE *outputFile, int totalFrequency)
+Node *huffmanTree(const int characterFrequencies[], int numCharacters)
+{
+    std::vector<long long> frequencies(characterFrequencies, characterFrequencies + numCharacters);
+    return huffmanTree(frequencies.data(), numCharacters);
+}
+
+std::string formatCodeLine(char character, double probability, const std::string &code)
+{
+    char probText[64], characterText[8];
+    snprintf(probText, sizeof(probText), "%f", probability);
+    // Control characters other than tab and carriage return, e.g. the run-length
+    // symbols, are written as \xHH so that code files stay readable text.
+    unsigned char c = static_cast<unsigned char>(character);
+    if (character == '\n')
+        strcpy(characterText, "\\n");
+    else if ((c < 0x20 && c != '\t' && c != '\r') || c == 0x7f)
+        snprintf(characterText, sizeof(characterText), "\\x%02x", c);
+    else
+        snprintf(characterText, sizeof(characterText), "%c", character);
+    return "\"" + std::string(characterText) + "\" \"" + probText + "\" \"" + code + "\"\n";
+}
+
+void traverse(Node *root, std::string code, FILE *outputFile, long long totalFrequency)
 {
     if (root == nullptr)
         return;
 
     if (!root->left && !root->right)
     {
-        fprintf(outputFile, "\"%s\" \"%f\" \"%s\"\n", (root->character == '\n' ? "\\n" : std::string(1, root->character)).c_str(),
-                static_cast<double>(root->count) / totalFrequency, code.c_str());
+        fputs(formatCodeLine(root->character, static_cast<double>(root->count) / totalFrequency, code).c_str(), outputFile);
     }
 
     traverse(root->left, code + "0", outputFile, totalFrequency);
     traverse(root->right, code + "1", outputFile, totalFrequency);
 }
 
-
-void HuffmanEncoding::generateAlphabetCode(char *trainFilePath, char *resultFilePath)
+void collectCodes(Node *root, std::string code, std::string codes[])
 {
-    FILE *inputFile = fopen(trainFilePath, "r");
-    if (!inputFile)
+    if (root == nullptr)
+        return;
+
+    if (!root->left && !root->right)
     {
-        std::cerr << "Error: Unable to open input file.\n";
+        // A tree with a single leaf still needs a one-bit code.
+        codes[static_cast<unsigned char>(root->character)] = code.empty() ? "0" : code;
         return;
     }
 
-    const int numCharacters = 128; // ASCII range
-    int count[numCharacters] = {0};
+    collectCodes(root->left, code + "0", codes);
+    collectCodes(root->right, code + "1", codes);
+}
+
+void deleteTree(Node *root)
+{
+    if (root == nullptr)
+        return;
+    deleteTree(root->left);
+    deleteTree(root->right);
+    delete root;
+}
+
+
+/**
+ * Add the training histogram of one file to count. The file is run-length transformed
+ * first if its start has long runs, as encodeText would do with it; runLength is set
+ * in that case. chunk and transformed are scratch buffers. Returns the number of bytes
+ * read, or -1 if the file cannot be opened.
+ */
+long long addFileHistogram(const char *trainFilePath, long long count[], bool &runLength, std::vector<uint8_t> &chunk, std::vector<uint8_t> &transformed)
+{
+    FILE *inputFile = fopen(trainFilePath, "rb");
+    if (!inputFile)
+        return -1;
 
-    char ch;
-    int totalFrequency = 0;
-    while ((ch = fgetc(inputFile)) != EOF)
+    long long bytes = 0;
+    chunk.resize(RunLengthEncoder::SAMPLE_SIZE);
+    size_t length = fread(chunk.data(), 1, chunk.size(), inputFile);
+    bool transform = RunLengthEncoder::isWorthwhile(chunk.data(), length);
+    runLength = runLength || transform;
+    while (length > 0)
     {
-        if (std::isprint(ch) || ch == '\n')
+        bytes += length;
+        const uint8_t *symbols = chunk.data();
+        size_t numSymbols = length;
+        if (transform)
         {
-            count[ch]++;
-            totalFrequency++;
+            transformed.clear();
+            RunLengthEncoder::encode(chunk.data(), length, transformed);
+            symbols = transformed.data();
+            numSymbols = transformed.size();
         }
+        for (size_t i = 0; i < numSymbols; ++i)
+        {
+            unsigned char ch = symbols[i];
+            if (std::isprint(ch) || ch == '\n' || (transform && RunLengthEncoder::isReserved(ch)))
+                count[ch]++;
+        }
+        length = fread(chunk.data(), 1, chunk.size(), inputFile);
     }
     fclose(inputFile);
+    return bytes;
+}
+
+/**
+ * Build the Huffman tree for a training histogram and write it as a code file.
+ */
+void writeAlphabetCode(long long count[], bool runLength, char *resultFilePath)
+{
+    // Any run length may occur in other files, so every digit needs a code.
+    for (int c = 0; runLength && c < NUM_CHARACTERS; ++c)
+    {
+        if (RunLengthEncoder::isReserved(c) && count[c] == 0)
+            count[c] = 1;
+    }
+    long long totalFrequency = 0;
+    for (int c = 0; c < NUM_CHARACTERS; ++c)
+        totalFrequency += count[c];
 
     FILE *outputFile = fopen(resultFilePath, "w");
     if (!outputFile)
@@ -109,82 +201,403 @@ void HuffmanEncoding::generateAlphabetCode(char *trainFilePath, char *resultFile
         return;
     }
 
-    Node *root = huffmanTree(count, numCharacters);
-
-    traverse(root, "", outputFile, totalFrequency);
+    CodecPhase phase("tree build");
+    phase.bytes = totalFrequency;
+    if (totalFrequency > 0)
+    {
+        Node *root = huffmanTree(count, NUM_CHARACTERS);
+        traverse(root, "", outputFile, totalFrequency);
+        deleteTree(root);
+    }
 
     fclose(outputFile);
+    HuffmanEncoding::generateDecodeTable(resultFilePath);
+}
+
+void HuffmanEncoding::generateAlphabetCode(char *trainFilePath, char *resultFilePath)
+{
+    long long count[NUM_CHARACTERS] = {0};
+    bool runLength = false;
+    {
+        CodecPhase phase("histogram");
+        std::vector<uint8_t> chunk, transformed;
+        phase.bytes = addFileHistogram(trainFilePath, count, runLength, chunk, transformed);
+        if (phase.bytes < 0)
+        {
+            std::cerr << "Error: Unable to open input file.\n";
+            return;
+        }
+    }
+    writeAlphabetCode(count, runLength, resultFilePath);
+}
+
+/**
+ * Append the regular files under directoryPath, in every subdirectory, to files.
+ */
+void listCorpusDirectory(const std::string &directoryPath, std::vector<std::string> &files)
+{
+    DIR *directory = opendir(directoryPath.c_str());
+    if (!directory)
+        return;
+    std::vector<std::string> subdirectories;
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        std::string path = directoryPath + "/" + entry->d_name;
+        struct stat status;
+        if (stat(path.c_str(), &status) != 0)
+            continue;
+        if (S_ISDIR(status.st_mode))
+            subdirectories.push_back(path);
+        else if (S_ISREG(status.st_mode))
+            files.push_back(path);
+    }
+    closedir(directory);
+    for (size_t d = 0; d < subdirectories.size(); ++d)
+        listCorpusDirectory(subdirectories[d], files);
+}
+
+void HuffmanEncoding::generateCorpusCode(char *corpusPath, char *resultFilePath, int numThreads)
+{
+    std::vector<std::string> files;
+    struct stat status;
+    if (stat(corpusPath, &status) == 0 && S_ISDIR(status.st_mode))
+        listCorpusDirectory(corpusPath, files);
+    else
+    {
+        glob_t matches;
+        if (glob(corpusPath, 0, NULL, &matches) == 0)
+        {
+            for (size_t m = 0; m < matches.gl_pathc; ++m)
+                files.push_back(matches.gl_pathv[m]);
+        }
+        globfree(&matches);
+    }
+    if (files.empty())
+    {
+        std::cerr << "Error: No training files found for " << corpusPath << ".\n";
+        return;
+    }
+
+    if (numThreads <= 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (static_cast<size_t>(numThreads) > files.size())
+        numThreads = files.size();
+
+    // Every worker keeps its own histogram and has at most one file open, so there is
+    // no locking and the open file count is bounded by the number of workers.
+    std::vector<std::vector<long long> > counts(numThreads, std::vector<long long>(NUM_CHARACTERS, 0));
+    std::vector<char> runLengths(numThreads, 0);
+    std::atomic<size_t> nextFile(0);
+    std::atomic<int> unreadable(0);
+    // One phase per worker, see CodecPhase.
+    std::vector<std::thread> workers;
+    for (int w = 0; w < numThreads; ++w)
+    {
+        workers.push_back(std::thread([&, w]()
+                                      {
+            CodecPhase phase("histogram");
+            std::vector<uint8_t> chunk, transformed;
+            bool runLength = false;
+            for (size_t f = nextFile++; f < files.size(); f = nextFile++)
+            {
+                long long fileBytes = addFileHistogram(files[f].c_str(), counts[w].data(), runLength, chunk, transformed);
+                if (fileBytes < 0)
+                    unreadable++;
+                else
+                    phase.bytes += fileBytes;
+            }
+            runLengths[w] = runLength; }));
+    }
+    for (int w = 0; w < numThreads; ++w)
+        workers[w].join();
+
+    long long count[NUM_CHARACTERS] = {0};
+    bool runLength = false;
+    for (int w = 0; w < numThreads; ++w)
+    {
+        for (int c = 0; c < NUM_CHARACTERS; ++c)
+            count[c] += counts[w][c];
+        runLength = runLength || runLengths[w];
+    }
+    if (unreadable > 0)
+        std::cerr << "Error: Unable to open " << unreadable << " of " << files.size() << " training files.\n";
+    LogManager::writePrintfToLog(LogManager::Level::Status, "HuffmanEncoding::generateCorpusCode",
+                                 "%d training files, %d threads", (int)files.size(), numThreads);
+
+    writeAlphabetCode(count, runLength, resultFilePath);
+}
+
+const char *findQuoteBefore(const char *start, const char *end)
+{
+    while (end > start)
+    {
+        --end;
+        if (*end == '"')
+            return end;
+    }
+    return nullptr;
 }
 
 void parseLine(const char *line, char *character, char *prob, char *code)
 {
+    character[0] = prob[0] = code[0] = '\0';
+
+    // Fields are located from the right so that a quoted '"' character does
+    // not end the first field early.
     const char *charStart = strchr(line, '"');
     if (!charStart)
         return; 
 
-    const char *charEnd = strchr(charStart + 1, '"');
-    if (!charEnd)
+    const char *codeEnd = findQuoteBefore(charStart + 1, line + strlen(line));
+    if (!codeEnd)
         return; 
 
-    strncpy(character, charStart + 1, charEnd - charStart - 1);
-    character[charEnd - charStart - 1] = '\0';
-
-    const char *probStart = strchr(charEnd + 1, '"');
-    if (!probStart)
+    const char *codeStart = findQuoteBefore(charStart + 1, codeEnd);
+    if (!codeStart)
         return; 
 
-    const char *probEnd = strchr(probStart + 1, '"');
+    const char *probEnd = findQuoteBefore(charStart + 1, codeStart);
     if (!probEnd)
         return; 
 
-    strncpy(prob, probStart + 1, probEnd - probStart - 1);
-    prob[probEnd - probStart - 1] = '\0';
-
-    const char *codeStart = strchr(probEnd + 1, '"');
-    if (!codeStart)
+    const char *probStart = findQuoteBefore(charStart + 1, probEnd);
+    if (!probStart)
         return; 
 
-    const char *codeEnd = strchr(codeStart + 1, '"');
-    if (!codeEnd)
+    const char *charEnd = findQuoteBefore(charStart + 1, probStart);
+    if (!charEnd)
         return; 
 
+    strncpy(character, charStart + 1, charEnd - charStart - 1);
+    character[charEnd - charStart - 1] = '\0';
+
+    strncpy(prob, probStart + 1, probEnd - probStart - 1);
+    prob[probEnd - probStart - 1] = '\0';
+
     strncpy(code, codeStart + 1, codeEnd - codeStart - 1);
     code[codeEnd - codeStart - 1] = '\0';
 }
 
-void HuffmanEncoding::encodeText(char *testASCIIFilePath, char *huffmanCodeFilePath, char *resultFilePath)
+/*
+ * Layout of an encoded file with a seek index:
+ *   #HUFFINDEX <interval> <indexOffset>   fixed width header line
+ *   <bits>                                the plain encoded stream, followed by '\n'
+ *   <bitOffset>                           one fixed width line per checkpoint
+ * Checkpoint k holds the offset, relative to the first bit, of the code for input
+ * character k * interval.
+ */
+#define SEEK_INDEX_HEADER_FORMAT "#HUFFINDEX %010d %020lld\n"
+#define SEEK_INDEX_MAGIC "#HUFFINDEX"
+const size_t SEEK_INDEX_MAGIC_LENGTH = 10;
+#define SEEK_INDEX_ENTRY_FORMAT "%020lld\n"
+const int SEEK_INDEX_ENTRY_WIDTH = 21;
+
+/*
+ * A stream whose first line is RUN_LENGTH_HEADER holds the codes of the run-length
+ * transformed text, see RunLength.h. The transform is applied per pipeline chunk.
+ */
+#define RUN_LENGTH_HEADER "#HUFFRLE\n"
+const size_t RUN_LENGTH_HEADER_LENGTH = 9;
+
+const int DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+bool readWholeFile(const char *filePath, std::vector<uint8_t> &data)
+{
+    FILE *file = fopen(filePath, "rb");
+    if (!file)
+        return false;
+
+    data.clear();
+    uint8_t buffer[DEFAULT_BLOCK_SIZE];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + length);
+    fclose(file);
+    return true;
+}
+
+bool writeWholeFile(const char *filePath, const std::vector<uint8_t> &data)
+{
+    FILE *file = fopen(filePath, "wb");
+    if (!file)
+        return false;
+
+    bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+    return written;
+}
+
+/**
+ * Append the codes of data to out. Returns false if a character has no code.
+ */
+bool appendCodes(const uint8_t *data, size_t size, const HuffmanCodeTable &table, std::vector<uint8_t> &out)
 {
-    FILE *huffmanCodeFile = fopen(huffmanCodeFilePath, "r");
-    if (!huffmanCodeFile)
+    for (size_t i = 0; i < size; ++i)
     {
-        std::cerr << "Error: Unable to open Huffman code file.\n";
+        if (!table.hasCode(data[i]))
+            return false;
+        const std::string &code = table.getCode(data[i]);
+        out.insert(out.end(), code.begin(), code.end());
+    }
+    return true;
+}
+
+/**
+ * Returns true if the run-length transform should be applied to an input starting
+ * with sample, i.e. the sample has long runs and the table can code the transform.
+ */
+bool useRunLength(const uint8_t *sample, size_t length, const HuffmanCodeTable &table)
+{
+    for (int c = 0; c < NUM_CHARACTERS; ++c)
+    {
+        if (RunLengthEncoder::isReserved(c) && !table.hasCode(c))
+            return false;
+    }
+    return RunLengthEncoder::isWorthwhile(sample, length);
+}
+
+/**
+ * Append the codes of data to out like appendCodes and record the bit offset of every
+ * seekIndexInterval-th input character in checkpoints. position and bitOffset hold the
+ * input and output offsets reached before data and are advanced past it.
+ */
+bool appendIndexedCodes(const uint8_t *data, size_t size, const HuffmanCodeTable &table, int seekIndexInterval,
+                        long long &position, long long &bitOffset, std::vector<long long> &checkpoints, std::vector<uint8_t> &out)
+{
+    size_t before = out.size();
+    for (size_t i = 0; i < size; ++i)
+    {
+        if ((position + static_cast<long long>(i)) % seekIndexInterval == 0)
+            checkpoints.push_back(bitOffset + static_cast<long long>(out.size() - before));
+        if (!table.hasCode(data[i]))
+            return false;
+        const std::string &code = table.getCode(data[i]);
+        out.insert(out.end(), code.begin(), code.end());
+    }
+    position += size;
+    bitOffset += out.size() - before;
+    return true;
+}
+
+bool HuffmanEncoding::encode(const uint8_t *data, size_t size, const HuffmanCodeTable &table, std::vector<uint8_t> &out, int seekIndexInterval)
+{
+    CodecPhase phase("encode");
+    phase.bytes = size;
+    out.clear();
+
+    if (seekIndexInterval <= 0 && useRunLength(data, std::min(size, RunLengthEncoder::SAMPLE_SIZE), table))
+    {
+        // Transformed in the chunks encodeText uses, so that both write the same stream.
+        out.insert(out.end(), RUN_LENGTH_HEADER, RUN_LENGTH_HEADER + RUN_LENGTH_HEADER_LENGTH);
+        std::vector<uint8_t> transformed;
+        for (size_t start = 0; start < size; start += StreamPipeline::DEFAULT_CHUNK_SIZE)
+        {
+            transformed.clear();
+            RunLengthEncoder::encode(data + start, std::min(size - start, StreamPipeline::DEFAULT_CHUNK_SIZE), transformed);
+            if (!appendCodes(transformed.data(), transformed.size(), table, out))
+                return false;
+        }
+        return true;
+    }
+
+    if (seekIndexInterval <= 0)
+        return appendCodes(data, size, table, out);
+
+    // The header is rewritten with the real index offset once the bit stream is complete.
+    char line[64];
+    snprintf(line, sizeof(line), SEEK_INDEX_HEADER_FORMAT, seekIndexInterval, 0LL);
+    out.insert(out.end(), line, line + strlen(line));
+
+    std::vector<long long> checkpoints;
+    long long position = 0, bitOffset = 0;
+    if (!appendIndexedCodes(data, size, table, seekIndexInterval, position, bitOffset, checkpoints, out))
+        return false;
+
+    out.push_back('\n');
+    long long indexOffset = out.size();
+    for (size_t k = 0; k < checkpoints.size(); ++k)
+    {
+        snprintf(line, sizeof(line), SEEK_INDEX_ENTRY_FORMAT, checkpoints[k]);
+        out.insert(out.end(), line, line + strlen(line));
+    }
+    snprintf(line, sizeof(line), SEEK_INDEX_HEADER_FORMAT, seekIndexInterval, indexOffset);
+    memcpy(out.data(), line, strlen(line));
+    return true;
+}
+
+void reportMissingCode(const uint8_t *data, size_t size, const HuffmanCodeTable &table)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (!table.hasCode(data[i]))
+        {
+            std::cerr << "Error: Huffman code not found for character '" << (char)data[i] << "'.\n";
+            return;
+        }
+    }
+}
+
+/**
+ * Write the seek indexed stream of inputFile to outputFile. The header is written with
+ * a placeholder index offset and rewritten once the index has been appended.
+ */
+void encodeIndexedFile(FILE *inputFile, FILE *outputFile, const HuffmanCodeTable &table, int seekIndexInterval)
+{
+    char line[64];
+    snprintf(line, sizeof(line), SEEK_INDEX_HEADER_FORMAT, seekIndexInterval, 0LL);
+    fputs(line, outputFile);
+
+    std::vector<long long> checkpoints;
+    long long position = 0, bitOffset = 0;
+    bool missingCode = false;
+    bool encoded = StreamPipeline::run(inputFile, outputFile,
+        [&](const uint8_t *data, size_t length, std::vector<uint8_t> &out)
+        {
+            CodecPhase phase("encode");
+            phase.bytes = length;
+            if (appendIndexedCodes(data, length, table, seekIndexInterval, position, bitOffset, checkpoints, out))
+                return true;
+            reportMissingCode(data, length, table);
+            missingCode = true;
+            return false;
+        });
+    if (!encoded)
+    {
+        if (!missingCode)
+            std::cerr << "Error: Unable to read input text file or write output encoded file.\n";
         return;
     }
 
-    const int MAX_CHARACTERS = 128; // ASCII range
-    char characters[MAX_CHARACTERS][256];
-    char codes[MAX_CHARACTERS][256];
-    int index = 0;
+    fputc('\n', outputFile);
+    long long indexOffset = ftell(outputFile);
+    for (size_t k = 0; k < checkpoints.size(); ++k)
+        fprintf(outputFile, SEEK_INDEX_ENTRY_FORMAT, checkpoints[k]);
+    fseek(outputFile, 0, SEEK_SET);
+    fprintf(outputFile, SEEK_INDEX_HEADER_FORMAT, seekIndexInterval, indexOffset);
+    if (ferror(outputFile))
+        std::cerr << "Error: Unable to write output encoded file.\n";
+}
 
-    char line[256];
-    while (fgets(line, sizeof(line), huffmanCodeFile))
+void HuffmanEncoding::encodeText(char *testASCIIFilePath, char *huffmanCodeFilePath, char *resultFilePath, int seekIndexInterval)
+{
+    HuffmanCodeTable table;
+    if (!table.load(huffmanCodeFilePath))
     {
-        char character[256], prob[256], code[256];
-        parseLine(line, character, prob, code);
-        strcpy(characters[index], character);
-        strcpy(codes[index], code); 
-        index++;
+        std::cerr << "Error: Unable to open Huffman code file.\n";
+        return;
     }
-    fclose(huffmanCodeFile);
 
-    FILE *inputFile = fopen(testASCIIFilePath, "r");
+    FILE *inputFile = fopen(testASCIIFilePath, "rb");
     if (!inputFile)
     {
         std::cerr << "Error: Unable to open input text file.\n";
         return;
     }
 
-    FILE *outputFile = fopen(resultFilePath, "w");
+    FILE *outputFile = fopen(resultFilePath, "wb");
     if (!outputFile)
     {
         std::cerr << "Error: Unable to open output encoded file.\n";
@@ -192,173 +605,1490 @@ void HuffmanEncoding::encodeText(char *testASCIIFilePath, char *huffmanCodeFileP
         return;
     }
 
-    int c;
-    while ((c = fgetc(inputFile)) != EOF)
+    if (seekIndexInterval > 0)
     {
-        if (c == '\n')
-        {
-            for (int i = 0; i < index; ++i)
-            {
-                if (strcmp(characters[i], "\\n") == 0)
-                {
-                    fprintf(outputFile, "%s", codes[i]);
-                    break;
-                }
-            }
-        }
-        else
+        encodeIndexedFile(inputFile, outputFile, table, seekIndexInterval);
+        fclose(inputFile);
+        fclose(outputFile);
+        return;
+    }
+
+    // The sample is encoded as the first chunk rather than read again, so the input
+    // does not have to be seekable.
+    std::vector<uint8_t> sample(RunLengthEncoder::SAMPLE_SIZE);
+    sample.resize(fread(sample.data(), 1, sample.size(), inputFile));
+    bool runLength = useRunLength(sample.data(), sample.size(), table);
+    if (runLength)
+        fputs(RUN_LENGTH_HEADER, outputFile);
+
+    std::vector<uint8_t> transformed;
+    bool missingCode = false;
+    StreamPipeline::Transform encodeChunk = [&](const uint8_t *data, size_t length, std::vector<uint8_t> &out)
+    {
+        CodecPhase phase("encode");
+        phase.bytes = length;
+        if (runLength)
         {
-            bool found = false;
-            for (int i = 0; i < index; ++i)
-            {
-                if (characters[i][0] == c && characters[i][1] == '\0')
-                {
-                    fprintf(outputFile, "%s", codes[i]);
-                    found = true;
-                    break;
-                }
-            }
-            if (!found)
-            {
-                std::cerr << "Error: Huffman code not found for character '" << (char)c << "'.\n";
-                fclose(inputFile);
-                fclose(outputFile);
-                return;
-            }
+            transformed.clear();
+            RunLengthEncoder::encode(data, length, transformed);
+            data = transformed.data();
+            length = transformed.size();
         }
-    }
+        if (appendCodes(data, length, table, out))
+            return true;
+        reportMissingCode(data, length, table);
+        missingCode = true;
+        return false;
+    };
+    std::vector<uint8_t> sampleCodes;
+    bool encoded = !ferror(inputFile) && encodeChunk(sample.data(), sample.size(), sampleCodes) &&
+                   fwrite(sampleCodes.data(), 1, sampleCodes.size(), outputFile) == sampleCodes.size() &&
+                   StreamPipeline::run(inputFile, outputFile, encodeChunk);
+    if (!encoded && !missingCode)
+        std::cerr << "Error: Unable to read input text file or write output encoded file.\n";
 
     fclose(inputFile);
     fclose(outputFile);
 }
 
-struct TrieNode
+int codeLineCharacter(const char *character)
 {
-    char data;
-    TrieNode *children[2]; 
-    bool isLeaf;
+    if (strcmp(character, "\\n") == 0)
+        return '\n';
+    unsigned int hex;
+    if (strlen(character) == 4 && sscanf(character, "\\x%2x", &hex) == 1)
+        return static_cast<int>(hex);
+    if (character[0] == '\0')
+        return -1;
+    return static_cast<unsigned char>(character[0]);
+}
 
-    TrieNode(char c) : data(c), isLeaf(false)
+/**
+ * Number of bits needed to encode a block with the given histogram, or -1 if the
+ * table has no code for one of the characters in the block.
+ */
+long long estimateBlockBits(const int count[], const HuffmanCodeTable &table)
+{
+    long long bits = 0;
+    for (int c = 0; c < NUM_CHARACTERS; ++c)
     {
-        children[0] = nullptr;
-        children[1] = nullptr;
+        if (count[c] == 0)
+            continue;
+        if (!table.hasCode(c))
+            return -1;
+        bits += static_cast<long long>(count[c]) * table.getCode(c).size();
     }
-};
+    return bits;
+}
 
-class HuffmanDecoder
+/**
+ * Build a Huffman table for one block and serialize it in the code file format.
+ * Returns the number of serialized entries.
+ */
+int buildBlockTable(const int count[], size_t blockLength, HuffmanCodeTable &table, std::string &serialized)
 {
-private:
-    TrieNode *root;
+    std::string codes[NUM_CHARACTERS];
+    Node *root = huffmanTree(count, NUM_CHARACTERS);
+    collectCodes(root, "", codes);
+    deleteTree(root);
 
-    void insert(const char *code, char character)
+    int numEntries = 0;
+    for (int c = 0; c < NUM_CHARACTERS; ++c)
     {
-        TrieNode *current = root;
-        for (int i = 0; code[i] != '\0'; ++i)
-        {
-            int index = (code[i] == '0') ? 0 : 1;
-            if (!current->children[index])
-            {
-                current->children[index] = new TrieNode('\0');
-            }
-            current = current->children[index];
-        }
-        current->data = character;
-        current->isLeaf = true;
+        if (codes[c].empty())
+            continue;
+        serialized += formatCodeLine(static_cast<char>(c), static_cast<double>(count[c]) / blockLength, codes[c]);
+        numEntries++;
     }
+    // Parsing the serialized form gives exactly the table the decoder will see.
+    table.parse(serialized.data(), serialized.size());
+    return numEntries;
+}
 
-    void decodeText(FILE *encodedFile, FILE *outputFile)
+void HuffmanEncoding::encodeTextMultiTable(char *testASCIIFilePath, char **huffmanCodeFilePaths, int numTables, char *resultFilePath, int blockSize,
+                                           EntropyBackend backend)
+{
+    std::unique_ptr<HuffmanCodeTable[]> tables(new HuffmanCodeTable[numTables]);
+    for (int t = 0; t < numTables; ++t)
     {
-        TrieNode *current = root;
-        char ch;
-        while ((ch = fgetc(encodedFile)) != EOF)
+        if (!tables[t].load(huffmanCodeFilePaths[t]))
         {
-            int bit = (ch == '0') ? 0 : 1;
-            current = current->children[bit];
-            if (current->isLeaf)
-            {
-                if (current->data == '\\')
-                {                              
-                    fprintf(outputFile, "\n"); 
-                }
-                else
-                {
-                    fprintf(outputFile, "%c", current->data); 
-                }
-                current = root; 
-            }
+            std::cerr << "Error: Unable to open Huffman code file " << huffmanCodeFilePaths[t] << ".\n";
+            return;
         }
     }
+    if (blockSize <= 0)
+        blockSize = DEFAULT_BLOCK_SIZE;
 
-public:
-    HuffmanDecoder()
+    // Coders that may be built from a block's own histogram. Pretrained tables are
+    // Huffman codes, so they are skipped when the file is forced to tANS.
+    std::vector<std::unique_ptr<EntropyCoder> > freshCoders;
+    if (backend != BACKEND_TANS)
+        freshCoders.push_back(std::unique_ptr<EntropyCoder>(new HuffmanCoder()));
+    if (backend != BACKEND_HUFFMAN)
+        freshCoders.push_back(std::unique_ptr<EntropyCoder>(new TansCoder()));
+    int numCandidateTables = (backend == BACKEND_TANS) ? 0 : numTables;
+
+    FILE *inputFile = fopen(testASCIIFilePath, "rb");
+    if (!inputFile)
     {
-        root = new TrieNode('\0');
+        std::cerr << "Error: Unable to open input text file.\n";
+        return;
     }
 
-    ~HuffmanDecoder()
+    FILE *outputFile = fopen(resultFilePath, "w");
+    if (!outputFile)
     {
-        deleteTrie(root);
+        std::cerr << "Error: Unable to open output encoded file.\n";
+        fclose(inputFile);
+        return;
     }
 
-    void buildTrie(char *huffmanCodeFilePath)
+    fprintf(outputFile, "#HUFFBLOCKS %d\n", numTables);
+
+    std::vector<char> block(blockSize);
+    std::vector<int> tableUses(numTables, 0);
+    std::vector<int> freshUses(freshCoders.size(), 0);
+    std::vector<std::string> freshHeaders(freshCoders.size());
+    std::vector<uint8_t> bits;
+    size_t blockLength;
+    while ((blockLength = fread(block.data(), 1, blockSize, inputFile)) > 0)
     {
-        FILE *huffmanCodeFile = fopen(huffmanCodeFilePath, "r");
-        if (!huffmanCodeFile)
+        int count[NUM_CHARACTERS] = {0};
+        bool inRange = true;
+        {
+            CodecPhase phase("histogram");
+            phase.bytes = blockLength;
+            for (size_t i = 0; i < blockLength; ++i)
+            {
+                unsigned char c = static_cast<unsigned char>(block[i]);
+                if (c >= NUM_CHARACTERS)
+                {
+                    inRange = false;
+                    break;
+                }
+                count[c]++;
+            }
+        }
+        if (!inRange)
         {
-            std::cerr << "Error: Unable to open Huffman code file.\n";
+            std::cerr << "Error: Character outside the ASCII range in input text file.\n";
+            fclose(inputFile);
+            fclose(outputFile);
             return;
         }
 
-        char lineBuffer[256]; 
-        while (fgets(lineBuffer, sizeof(lineBuffer), huffmanCodeFile))
+        int bestTable = -1;
+        long long bestBits = -1;
+        for (int t = 0; t < numCandidateTables; ++t)
         {
-            char character[128], probability[128], code[128];
-            sscanf(lineBuffer, "\"%127[^\"]\" \"%127[^\"]\" \"%127[^\"]\"", character, probability, code);
-            insert(code, character[0]);
+            long long tableBits = estimateBlockBits(count, tables[t]);
+            if (tableBits >= 0 && (bestBits < 0 || tableBits < bestBits))
+            {
+                bestTable = t;
+                bestBits = tableBits;
+            }
         }
-        fclose(huffmanCodeFile);
-    }
 
-    void decodeText(char *testEncodedFilePath, char *resultFilePath)
-    {
-        FILE *encodedFile = fopen(testEncodedFilePath, "r");
-        if (!encodedFile)
+        // A fresh table is only worth it when its savings cover the cost of
+        // storing it in the block header.
+        int bestFresh = -1;
+        long long bestFreshCost = -1;
+        std::vector<int> freshEntries(freshCoders.size());
         {
-            std::cerr << "Error: Unable to open input encoded file.\n";
-            return;
+            CodecPhase phase("tree build");
+            phase.bytes = blockLength;
+            for (size_t f = 0; f < freshCoders.size(); ++f)
+            {
+                freshHeaders[f].clear();
+                freshEntries[f] = freshCoders[f]->build(count, blockLength, freshHeaders[f]);
+                long long cost = freshCoders[f]->estimateBits(count) + static_cast<long long>(freshHeaders[f].size());
+                if (bestFresh < 0 || cost < bestFreshCost)
+                {
+                    bestFresh = f;
+                    bestFreshCost = cost;
+                }
+            }
         }
 
-        FILE *outputFile = fopen(resultFilePath, "w");
-        if (!outputFile)
+        CodecPhase phase("encode");
+        phase.bytes = blockLength;
+        bits.clear();
+        const uint8_t *blockData = reinterpret_cast<const uint8_t *>(block.data());
+        if (bestTable < 0 || bestFreshCost < bestBits)
         {
-            std::cerr << "Error: Unable to open output decoded file.\n";
-            fclose(encodedFile);
-            return;
+            fprintf(outputFile, "#B %c %zu %d\n", freshCoders[bestFresh]->blockType(), blockLength, freshEntries[bestFresh]);
+            fputs(freshHeaders[bestFresh].c_str(), outputFile);
+            freshCoders[bestFresh]->encode(blockData, blockLength, bits);
+            freshUses[bestFresh]++;
         }
+        else
+        {
+            fprintf(outputFile, "#B T %d %zu\n", bestTable, blockLength);
+            appendCodes(blockData, blockLength, tables[bestTable], bits);
+            tableUses[bestTable]++;
+        }
+        bits.push_back('\n');
+        fwrite(bits.data(), 1, bits.size(), outputFile);
+    }
 
-        decodeText(encodedFile, outputFile);
+    fclose(inputFile);
+    fclose(outputFile);
 
-        fclose(encodedFile);
-        fclose(outputFile);
-    }
+    for (int t = 0; t < numTables; ++t)
+        LogManager::writePrintfToLog(LogManager::Level::Status, "HuffmanEncoding::encodeTextMultiTable",
+                                     "table %d (%s) chosen for %d blocks", t, huffmanCodeFilePaths[t], tableUses[t]);
+    for (size_t f = 0; f < freshCoders.size(); ++f)
+        LogManager::writePrintfToLog(LogManager::Level::Status, "HuffmanEncoding::encodeTextMultiTable",
+                                     "fresh '%c' table chosen for %d blocks", freshCoders[f]->blockType(), freshUses[f]);
+}
 
-private:
-    void deleteTrie(TrieNode *node)
+HuffmanEncoding::EncodingEstimate HuffmanEncoding::estimateEncoding(char *testASCIIFilePath, char *huffmanCodeFilePath, bool printReport)
+{
+    EncodingEstimate estimate = {0, 0, 0, 0.0, 0.0, false, false};
+
+    HuffmanCodeTable table;
+    if (!table.load(huffmanCodeFilePath))
     {
-        if (!node)
-            return;
-        for (int i = 0; i < 2; ++i)
-        {
-            if (node->children[i])
-                deleteTrie(node->children[i]);
-        }
-        delete node;
+        std::cerr << "Error: Unable to open Huffman code file.\n";
+        return estimate;
     }
-};
 
-void HuffmanEncoding::decodeText(char *testEncodedFilePath, char *huffmanCodeFilePath, char *resultFilePath)
-{
-    HuffmanDecoder decoder;
-    decoder.buildTrie(huffmanCodeFilePath);
-    decoder.decodeText(testEncodedFilePath, resultFilePath);
+    FILE *inputFile = fopen(testASCIIFilePath, "rb");
+    if (!inputFile)
+    {
+        std::cerr << "Error: Unable to open input text file.\n";
+        return estimate;
+    }
+
+    // Decide on the run-length transform and apply it chunk by chunk exactly as
+    // encodeText does, so the histogram counts the symbols that are coded.
+    // The sample is the first chunk there, too.
+    std::vector<uint8_t> buffer(RunLengthEncoder::SAMPLE_SIZE);
+    size_t length = fread(buffer.data(), 1, buffer.size(), inputFile);
+    estimate.runLength = useRunLength(buffer.data(), length, table);
+
+    long long count[256] = {0};
+    std::vector<uint8_t> transformed;
+    {
+        CodecPhase phase("histogram");
+        for (; length > 0; length = fread(buffer.data(), 1, buffer.size(), inputFile))
+        {
+            estimate.numCharacters += length;
+            phase.bytes += length;
+            const uint8_t *symbols = buffer.data();
+            if (estimate.runLength)
+            {
+                transformed.clear();
+                RunLengthEncoder::encode(buffer.data(), length, transformed);
+                symbols = transformed.data();
+                length = transformed.size();
+            }
+            for (size_t i = 0; i < length; ++i)
+                count[symbols[i]]++;
+            buffer.resize(StreamPipeline::DEFAULT_CHUNK_SIZE);
+        }
+    }
+    fclose(inputFile);
+
+    long long numSymbols = 0;
+    estimate.encodable = true;
+    for (int c = 0; c < 256; ++c)
+    {
+        if (count[c] == 0)
+            continue;
+        numSymbols += count[c];
+        if (!table.hasCode(c))
+            estimate.encodable = false;
+        else
+            estimate.encodedBits += count[c] * static_cast<long long>(table.getCode(c).size());
+    }
+    estimate.encodedBytes = estimate.encodedBits + (estimate.runLength ? RUN_LENGTH_HEADER_LENGTH : 0);
+
+    for (int c = 0; c < 256; ++c)
+    {
+        if (count[c] == 0)
+            continue;
+        double p = static_cast<double>(count[c]) / numSymbols;
+        estimate.entropyBits -= count[c] * log2(p);
+    }
+    if (estimate.numCharacters > 0)
+    {
+        estimate.entropyBits /= estimate.numCharacters;
+        estimate.averageCodeLength = static_cast<double>(estimate.encodedBits) / estimate.numCharacters;
+    }
+
+    if (printReport)
+    {
+        printf("%-6s %12s %10s %8s %10s %14s\n", "char", "count", "prob", "codeLen", "idealLen", "bits");
+        for (int c = 0; c < 256; ++c)
+        {
+            if (count[c] == 0)
+                continue;
+            double p = static_cast<double>(count[c]) / numSymbols;
+            char name[8];
+            if (c == '\n')
+                snprintf(name, sizeof(name), "\\n");
+            else if (c < 32 || c >= 127)
+                snprintf(name, sizeof(name), "\\x%02x", c);
+            else
+                snprintf(name, sizeof(name), "%c", c);
+            if (table.hasCode(c))
+                printf("%-6s %12lld %10.6f %8zu %10.4f %14lld\n", name, count[c], p, table.getCode(c).size(), -log2(p),
+                       count[c] * static_cast<long long>(table.getCode(c).size()));
+            else
+                printf("%-6s %12lld %10.6f %8s %10.4f %14s\n", name, count[c], p, "-", -log2(p), "no code");
+        }
+        printf("characters = %lld\n", estimate.numCharacters);
+        if (estimate.runLength)
+            printf("run-length transform applied, %lld symbols coded\n", numSymbols);
+        printf("entropy = %f bits/char, average code length = %f bits/char\n", estimate.entropyBits, estimate.averageCodeLength);
+        if (estimate.encodable)
+            printf("encoded size = %lld bits (%lld bytes written by encodeText, %lld bytes bit-packed)\n",
+                   estimate.encodedBits, estimate.encodedBytes, (estimate.encodedBits + 7) / 8);
+        else
+            printf("encoded size = unavailable, the code file does not cover every input character\n");
+    }
+
+    return estimate;
+}
+
+/**
+ * Node of the flattened decode trie. A child is the index of the next node, the
+ * character plus one negated at a leaf, or 0 where no code continues, since the
+ * root at index 0 is never a child.
+ */
+struct DecodeNode
+{
+    int32_t children[2];
+};
+
+/**
+ * Header of a decode table file, followed by numNodes DecodeNode entries. Fields are
+ * in host byte order. The size and modification time of the code file the table was
+ * built from let a table that is older than its code file be detected.
+ */
+struct DecodeTableHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numNodes;
+    int64_t codeFileSize;
+    int64_t codeFileTime; // nanoseconds since the epoch
+    uint64_t checksum;    // FNV-1a over the nodes
+};
+
+#define DECODE_TABLE_MAGIC "HUFFDTAB"
+#define DECODE_TABLE_SUFFIX ".dtab"
+const uint32_t DECODE_TABLE_VERSION = 1;
+
+uint64_t decodeTableChecksum(const DecodeNode *nodes, size_t numNodes)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(nodes);
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < numNodes * sizeof(DecodeNode); ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash;
+}
+
+int64_t modificationTime(const struct stat &status)
+{
+    return static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+}
+
+/**
+ * Position of a streaming decode between two chunks of encoded data.
+ */
+struct DecodeState
+{
+    int32_t node;          // 0 at a character boundary
+    bool atStreamStart;    // nothing has been consumed yet
+    bool inHeader;         // inside a '#' header line
+    bool indexed;          // the header is a seek index header
+    bool finished;         // the newline before the seek index ended the bits
+};
+
+/**
+ * Result of decoding one chunk of a stream from a guessed code boundary. A boundary
+ * is the position of the first bit after a decoded character, stored together with
+ * the number of characters decoded up to it.
+ */
+struct SpanDecode
+{
+    std::vector<uint8_t> out;
+    std::vector<std::pair<size_t, size_t> > head;    // boundaries in the sync window at the chunk start
+    std::vector<std::pair<size_t, size_t> > overrun; // boundaries at or after the chunk end
+    long long lastInvalidBit;                         // position of the last invalid code's final bit, -1 if none
+    bool badCharacter;                                // a character that is not a bit was found
+};
+
+class HuffmanDecoder
+{
+private:
+    std::vector<DecodeNode> built; // nodes added by insert
+    MappedFile tableFile;          // nodes of a decode table file
+    const DecodeNode *nodes;
+    size_t numNodes;
+
+public:
+    HuffmanDecoder() : built(1), nodes(NULL), numNodes(0)
+    {
+        built[0].children[0] = 0;
+        built[0].children[1] = 0;
+        nodes = built.data();
+        numNodes = built.size();
+    }
+
+    /**
+     * Add a code to the trie. Must not be called after loadTable.
+     */
+    void insert(const char *code, char character)
+    {
+        size_t current = 0;
+        for (int i = 0; code[i] != '\0'; ++i)
+        {
+            int index = (code[i] == '0') ? 0 : 1;
+            if (code[i + 1] == '\0')
+            {
+                built[current].children[index] = -(static_cast<unsigned char>(character) + 1);
+                break;
+            }
+            if (built[current].children[index] <= 0)
+            {
+                built[current].children[index] = static_cast<int32_t>(built.size());
+                built.push_back(DecodeNode());
+                built.back().children[0] = 0;
+                built.back().children[1] = 0;
+            }
+            current = built[current].children[index];
+        }
+        nodes = built.data();
+        numNodes = built.size();
+    }
+
+    /**
+     * Write the trie as a decode table file for the code file described by codeFile.
+     * The file is written under a temporary name and renamed, so a decoder never maps
+     * a partly written table. Returns false if the file cannot be written.
+     */
+    bool saveTable(const char *decodeTablePath, const struct stat &codeFile) const
+    {
+        DecodeTableHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, DECODE_TABLE_MAGIC, sizeof(header.magic));
+        header.version = DECODE_TABLE_VERSION;
+        header.numNodes = static_cast<uint32_t>(numNodes);
+        header.codeFileSize = codeFile.st_size;
+        header.codeFileTime = modificationTime(codeFile);
+        header.checksum = decodeTableChecksum(nodes, numNodes);
+
+        std::string temporaryPath = std::string(decodeTablePath) + ".tmp";
+        FILE *file = fopen(temporaryPath.c_str(), "wb");
+        if (!file)
+            return false;
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(nodes, sizeof(DecodeNode), numNodes, file) == numNodes;
+        ok = (fclose(file) == 0) && ok;
+        if (ok && rename(temporaryPath.c_str(), decodeTablePath) == 0)
+            return true;
+        remove(temporaryPath.c_str());
+        return false;
+    }
+
+    /**
+     * Map a decode table file and decode with its nodes in place. The table is rejected
+     * if it is malformed, fails its checksum or was not built from the code file
+     * described by codeFile; the trie is left as it was then.
+     */
+    bool loadTable(const char *decodeTablePath, const struct stat &codeFile)
+    {
+        if (!tableFile.open(decodeTablePath))
+            return false;
+        DecodeTableHeader header;
+        if (tableFile.size() < sizeof(header))
+        {
+            tableFile.close();
+            return false;
+        }
+        memcpy(&header, tableFile.data(), sizeof(header));
+        const DecodeNode *mapped = reinterpret_cast<const DecodeNode *>(tableFile.data() + sizeof(header));
+        bool valid = memcmp(header.magic, DECODE_TABLE_MAGIC, sizeof(header.magic)) == 0 &&
+                     header.version == DECODE_TABLE_VERSION && header.numNodes > 0 &&
+                     tableFile.size() == sizeof(header) + static_cast<size_t>(header.numNodes) * sizeof(DecodeNode) &&
+                     header.codeFileSize == codeFile.st_size && header.codeFileTime == modificationTime(codeFile) &&
+                     header.checksum == decodeTableChecksum(mapped, header.numNodes);
+        // The decode loops index nodes without bounds checks.
+        for (uint32_t n = 0; valid && n < header.numNodes; ++n)
+        {
+            for (int b = 0; b < 2; ++b)
+            {
+                int32_t child = mapped[n].children[b];
+                if (child >= static_cast<int64_t>(header.numNodes) || child < -NUM_CHARACTERS)
+                    valid = false;
+            }
+        }
+        if (!valid)
+        {
+            tableFile.close();
+            return false;
+        }
+        nodes = mapped;
+        numNodes = header.numNodes;
+        return true;
+    }
+
+    /**
+     * Decode exactly numSymbols characters from the encoded stream. Returns the number
+     * of characters decoded, which is smaller on a truncated or corrupt stream.
+     * If outputFile is NULL the characters are skipped.
+     */
+    long decodeSymbols(FILE *encodedFile, FILE *outputFile, long numSymbols) const
+    {
+        CodecPhase phase("decode");
+        int32_t current = 0;
+        long decoded = 0;
+        int ch;
+        while (decoded < numSymbols && ((ch = fgetc(encodedFile)) == '0' || ch == '1'))
+        {
+            current = nodes[current].children[(ch == '0') ? 0 : 1];
+            if (current == 0)
+                return decoded;
+            if (current < 0)
+            {
+                if (outputFile)
+                    fputc(-current - 1, outputFile);
+                phase.bytes = ++decoded;
+                current = 0;
+            }
+        }
+        return decoded;
+    }
+
+    /**
+     * Decode the bits in data until a character that is not a bit is reached or, if
+     * numSymbols is not negative, until numSymbols characters were produced. Returns the
+     * number of bytes of data consumed, or -1 if the data contains an invalid code.
+     */
+    long decodeBuffer(const uint8_t *data, size_t length, std::vector<uint8_t> &out, long numSymbols) const
+    {
+        CodecPhase phase("decode");
+        int32_t current = 0;
+        long decoded = 0;
+        size_t i = 0;
+        for (; i < length && decoded != numSymbols; ++i)
+        {
+            if (data[i] != '0' && data[i] != '1')
+                break;
+            current = nodes[current].children[data[i] - '0'];
+            if (current == 0)
+                return -1;
+            if (current < 0)
+            {
+                out.push_back(static_cast<uint8_t>(-current - 1));
+                decoded++;
+                current = 0;
+            }
+        }
+        phase.bytes = decoded;
+        return static_cast<long>(i);
+    }
+
+    /**
+     * Decode one chunk of a plain or seek indexed stream, continuing from state. A header
+     * line at the start of the stream is skipped. In a seek indexed stream the newline
+     * before the index ends the bits and the rest is ignored. Returns false if the data
+     * contains an invalid code or any other character that is not a bit.
+     */
+    bool decodeChunk(const uint8_t *data, size_t length, std::vector<uint8_t> &out, DecodeState &state) const
+    {
+        CodecPhase phase("decode");
+        size_t i = 0;
+        if (state.atStreamStart && length > 0)
+        {
+            state.atStreamStart = false;
+            state.inHeader = (data[0] == '#');
+            state.indexed = length >= SEEK_INDEX_MAGIC_LENGTH && memcmp(data, SEEK_INDEX_MAGIC, SEEK_INDEX_MAGIC_LENGTH) == 0;
+        }
+        if (state.inHeader)
+        {
+            while (i < length && data[i] != '\n')
+                ++i;
+            if (i == length)
+                return true;
+            state.inHeader = false;
+            ++i;
+        }
+
+        int32_t current = state.node;
+        size_t before = out.size();
+        for (; i < length && !state.finished; ++i)
+        {
+            if (data[i] != '0' && data[i] != '1')
+            {
+                if (!state.indexed || data[i] != '\n')
+                    return false;
+                state.finished = true;
+                break;
+            }
+            current = nodes[current].children[data[i] - '0'];
+            if (current == 0)
+                return false;
+            if (current < 0)
+            {
+                out.push_back(static_cast<uint8_t>(-current - 1));
+                current = 0;
+            }
+        }
+        state.node = current;
+        phase.bytes = out.size() - before;
+        return true;
+    }
+
+    /**
+     * Decode data[begin, chunkEnd) as if a code started at begin, then continue to the
+     * first boundary at or after windowEnd. Boundaries before begin + headWindow and at
+     * or after chunkEnd are recorded. An invalid code restarts at the root, since begin
+     * may not be a real boundary.
+     */
+    void decodeSpan(const uint8_t *data, size_t begin, size_t chunkEnd, size_t windowEnd, size_t headWindow, SpanDecode &span) const
+    {
+        span.out.clear();
+        span.head.clear();
+        span.overrun.clear();
+        span.lastInvalidBit = -1;
+        span.badCharacter = false;
+        span.out.reserve((chunkEnd - begin) / 2);
+
+        const size_t headEnd = begin + headWindow;
+        span.head.push_back(std::make_pair(begin, static_cast<size_t>(0)));
+        int32_t current = 0;
+        for (size_t i = begin; i < windowEnd; ++i)
+        {
+            if (data[i] != '0' && data[i] != '1')
+            {
+                span.badCharacter = true;
+                return;
+            }
+            current = nodes[current].children[data[i] - '0'];
+            if (current == 0)
+                span.lastInvalidBit = i;
+            else if (current < 0)
+                span.out.push_back(static_cast<uint8_t>(-current - 1));
+            else
+                continue;
+
+            current = 0;
+            size_t boundary = i + 1;
+            if (boundary < headEnd)
+                span.head.push_back(std::make_pair(boundary, span.out.size()));
+            if (boundary >= chunkEnd)
+            {
+                span.overrun.push_back(std::make_pair(boundary, span.out.size()));
+                if (boundary >= windowEnd)
+                    return;
+            }
+        }
+    }
+
+    void decodeRange(char *testEncodedFilePath, long offset, long length, char *resultFilePath) const
+    {
+        FILE *encodedFile = fopen(testEncodedFilePath, "r");
+        if (!encodedFile)
+        {
+            std::cerr << "Error: Unable to open input encoded file.\n";
+            return;
+        }
+
+        FILE *outputFile = fopen(resultFilePath, "w");
+        if (!outputFile)
+        {
+            std::cerr << "Error: Unable to open output decoded file.\n";
+            fclose(encodedFile);
+            return;
+        }
+
+        // Without a seek index the range is found by decoding from the first bit.
+        long checkpointOffset = 0;
+        char line[256];
+        int interval;
+        long long indexOffset;
+        if (fgets(line, sizeof(line), encodedFile) && sscanf(line, "#HUFFINDEX %d %lld", &interval, &indexOffset) == 2 && interval > 0)
+        {
+            long dataStart = ftell(encodedFile);
+            long numCheckpoints = (fileSize(encodedFile) - indexOffset) / SEEK_INDEX_ENTRY_WIDTH;
+            long k = offset / interval;
+            if (k >= numCheckpoints)
+                k = numCheckpoints - 1;
+
+            long long bitOffset = 0;
+            if (k > 0)
+            {
+                fseek(encodedFile, indexOffset + k * SEEK_INDEX_ENTRY_WIDTH, SEEK_SET);
+                if (fscanf(encodedFile, "%lld", &bitOffset) == 1)
+                    checkpointOffset = k * interval;
+                else
+                    bitOffset = 0;
+            }
+            fseek(encodedFile, dataStart + bitOffset, SEEK_SET);
+        }
+        else
+        {
+            rewind(encodedFile);
+            skipHeader(encodedFile);
+        }
+
+        if (decodeSymbols(encodedFile, NULL, offset - checkpointOffset) == offset - checkpointOffset)
+            decodeSymbols(encodedFile, outputFile, length);
+
+        fclose(encodedFile);
+        fclose(outputFile);
+    }
+
+private:
+    HuffmanDecoder(const HuffmanDecoder &);
+    HuffmanDecoder &operator=(const HuffmanDecoder &);
+
+    static void skipHeader(FILE *encodedFile)
+    {
+        int ch = fgetc(encodedFile);
+        if (ch != '#')
+        {
+            ungetc(ch, encodedFile);
+            return;
+        }
+        while (ch != EOF && ch != '\n')
+            ch = fgetc(encodedFile);
+    }
+
+    static long fileSize(FILE *file)
+    {
+        long current = ftell(file);
+        fseek(file, 0, SEEK_END);
+        long end = ftell(file);
+        fseek(file, current, SEEK_SET);
+        return end;
+    }
+};
+
+HuffmanCodeTable::HuffmanCodeTable() : decoder(new HuffmanDecoder())
+{
+}
+
+HuffmanCodeTable::~HuffmanCodeTable()
+{
+    delete decoder;
+}
+
+bool HuffmanCodeTable::load(const char *huffmanCodeFilePath)
+{
+    std::vector<uint8_t> text;
+    if (!readWholeFile(huffmanCodeFilePath, text))
+        return false;
+    return parse(reinterpret_cast<const char *>(text.data()), text.size());
+}
+
+bool HuffmanCodeTable::loadForDecoding(const char *huffmanCodeFilePath)
+{
+    struct stat codeFile;
+    if (stat(huffmanCodeFilePath, &codeFile) == 0)
+    {
+        std::string decodeTablePath = std::string(huffmanCodeFilePath) + DECODE_TABLE_SUFFIX;
+        HuffmanDecoder *mapped = new HuffmanDecoder();
+        if (mapped->loadTable(decodeTablePath.c_str(), codeFile))
+        {
+            for (int c = 0; c < NUM_CHARACTERS; ++c)
+                codes[c].clear();
+            delete decoder;
+            decoder = mapped;
+            return true;
+        }
+        delete mapped;
+    }
+    return load(huffmanCodeFilePath);
+}
+
+void HuffmanEncoding::generateDecodeTable(char *huffmanCodeFilePath)
+{
+    HuffmanCodeTable table;
+    struct stat codeFile;
+    if (!table.load(huffmanCodeFilePath) || stat(huffmanCodeFilePath, &codeFile) != 0)
+    {
+        std::cerr << "Error: Unable to open Huffman code file.\n";
+        return;
+    }
+    std::string decodeTablePath = std::string(huffmanCodeFilePath) + DECODE_TABLE_SUFFIX;
+    if (!table.decoder->saveTable(decodeTablePath.c_str(), codeFile))
+        std::cerr << "Error: Unable to write decode table file.\n";
+}
+
+bool HuffmanCodeTable::parse(const char *text, size_t length)
+{
+    for (int c = 0; c < NUM_CHARACTERS; ++c)
+        codes[c].clear();
+    delete decoder;
+    decoder = new HuffmanDecoder();
+
+    char line[256];
+    size_t start = 0;
+    while (start < length)
+    {
+        const char *lineEnd = static_cast<const char *>(memchr(text + start, '\n', length - start));
+        size_t end = lineEnd ? lineEnd - text : length;
+        if (end - start >= sizeof(line))
+            return false;
+        memcpy(line, text + start, end - start);
+        line[end - start] = '\0';
+        start = end + 1;
+
+        char character[256], prob[256], code[256];
+        parseLine(line, character, prob, code);
+        int c = codeLineCharacter(character);
+        if (c < 0 || c >= NUM_CHARACTERS || code[0] == '\0')
+            continue;
+        codes[c] = code;
+        decoder->insert(code, static_cast<char>(c));
+    }
+    return true;
+}
+
+bool HuffmanCodeTable::hasCode(int character) const
+{
+    return character >= 0 && character < NUM_CHARACTERS && !codes[character].empty();
+}
+
+const std::string &HuffmanCodeTable::getCode(int character) const
+{
+    return codes[character];
+}
+
+EntropyCoder *EntropyCoder::create(char blockType)
+{
+    if (blockType == 'F')
+        return new HuffmanCoder();
+    if (blockType == 'A')
+        return new TansCoder();
+    return NULL;
+}
+
+int HuffmanCoder::build(const int count[], size_t blockLength, std::string &serialized)
+{
+    return buildBlockTable(count, blockLength, table, serialized);
+}
+
+bool HuffmanCoder::parse(const char *text, size_t length)
+{
+    return table.parse(text, length);
+}
+
+long long HuffmanCoder::estimateBits(const int count[]) const
+{
+    return estimateBlockBits(count, table);
+}
+
+bool HuffmanCoder::encode(const uint8_t *data, size_t size, std::vector<uint8_t> &out) const
+{
+    return appendCodes(data, size, table, out);
+}
+
+long HuffmanCoder::decode(const uint8_t *data, size_t length, long numSymbols, std::vector<uint8_t> &out) const
+{
+    return table.decoder->decodeBuffer(data, length, out, numSymbols);
+}
+
+/**
+ * Incremental decoder for every stream decodeText accepts: plain, seek indexed,
+ * run-length transformed and block streams. The stream is passed in chunks, in order.
+ * Only the unfinished part of a block is kept between chunks, so the memory used
+ * depends on the block size and not on the stream size.
+ */
+class StreamDecoder
+{
+public:
+    /**
+     * Plain and run-length streams are decoded with decoders[0]; block streams may
+     * refer to any of the numTables decoders.
+     */
+    StreamDecoder(const HuffmanDecoder *const *decoders, int numTables)
+        : decoders(decoders), numTables(numTables), kind(KIND_UNKNOWN), headerRead(false),
+          scanned(0), linesSeen(0), linesNeeded(0), tableStart(0), bitsStart(0),
+          blockKind(0), blockFirst(0), blockSecond(0)
+    {
+        state.node = 0;
+        state.atStreamStart = true;
+        state.inHeader = false;
+        state.indexed = false;
+        state.finished = false;
+    }
+
+    /**
+     * Decode the next chunk of the stream and append the text to out. Returns false if
+     * the stream is malformed.
+     */
+    bool decode(const uint8_t *data, size_t length, std::vector<uint8_t> &out)
+    {
+        if (kind == KIND_UNKNOWN && length > 0)
+        {
+            if (length >= 11 && memcmp(data, "#HUFFBLOCKS", 11) == 0)
+                kind = KIND_BLOCKS;
+            else if (length >= RUN_LENGTH_HEADER_LENGTH && memcmp(data, RUN_LENGTH_HEADER, RUN_LENGTH_HEADER_LENGTH) == 0)
+                kind = KIND_RUN_LENGTH;
+            else
+                kind = KIND_PLAIN;
+            if (kind != KIND_BLOCKS && numTables < 1)
+            {
+                std::cerr << "Error: Input is not a block encoded file.\n";
+                return false;
+            }
+        }
+
+        if (kind == KIND_BLOCKS)
+            return decodeBlocks(data, length, out);
+        if (kind == KIND_PLAIN)
+            return decoders[0]->decodeChunk(data, length, out, state);
+        transformed.clear();
+        return decoders[0]->decodeChunk(data, length, transformed, state) &&
+               runLengthDecoder.decode(transformed.data(), transformed.size(), out);
+    }
+
+    /**
+     * Append the text that is only complete once the stream has ended. Returns false if
+     * the stream ended inside a code, a block or a run, or a seek indexed stream has no
+     * index.
+     */
+    bool finish(std::vector<uint8_t> &out)
+    {
+        if (kind != KIND_BLOCKS && (state.node != 0 || state.inHeader || (state.indexed && !state.finished)))
+            return false;
+        if (kind == KIND_RUN_LENGTH)
+            return runLengthDecoder.finish(out);
+        if (kind == KIND_BLOCKS && !pending.empty())
+        {
+            std::cerr << "Error: Truncated or corrupt block in encoded file.\n";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    enum Kind
+    {
+        KIND_UNKNOWN,
+        KIND_PLAIN,
+        KIND_RUN_LENGTH,
+        KIND_BLOCKS
+    };
+
+    /**
+     * Decode every unit, i.e. the stream header line or a whole block, that is complete
+     * in pending followed by data, and keep the rest in pending.
+     */
+    bool decodeBlocks(const uint8_t *data, size_t length, std::vector<uint8_t> &out)
+    {
+        // Most units end inside the chunk they start in; only the rest is copied.
+        if (!pending.empty())
+        {
+            pending.insert(pending.end(), data, data + length);
+            data = pending.data();
+            length = pending.size();
+        }
+
+        size_t start = 0;
+        int found;
+        while ((found = findUnitEnd(data + start, length - start)) > 0)
+        {
+            if (!decodeUnit(data + start, scanned, out))
+                return false;
+            start += scanned;
+            scanned = 0;
+            linesSeen = 0;
+            linesNeeded = 0;
+        }
+        if (found < 0)
+            return false;
+
+        if (data == pending.data())
+            pending.erase(pending.begin(), pending.begin() + start);
+        else
+            pending.assign(data + start, data + length);
+        return true;
+    }
+
+    /**
+     * Scan the unit starting at unit for its end. Returns 1 once the unit is complete,
+     * with scanned holding its length, 0 if more data is needed and -1 if its block
+     * header is malformed.
+     */
+    int findUnitEnd(const uint8_t *unit, size_t length)
+    {
+        while (scanned < length)
+        {
+            const uint8_t *lineEnd = static_cast<const uint8_t *>(memchr(unit + scanned, '\n', length - scanned));
+            if (!lineEnd)
+            {
+                scanned = length;
+                return 0;
+            }
+            scanned = lineEnd - unit + 1;
+            linesSeen++;
+            if (linesSeen == 1 && !parseUnitHeader(unit, scanned))
+                return -1;
+            if (linesSeen == 1)
+                tableStart = scanned;
+            if (linesSeen == linesNeeded - 1)
+                bitsStart = scanned;
+            if (linesSeen == linesNeeded)
+                return 1;
+        }
+        return 0;
+    }
+
+    /**
+     * Read the first line of a unit and set the number of lines the unit has: a block
+     * is its header line, its table lines and its bits, which end with '\n'.
+     */
+    bool parseUnitHeader(const uint8_t *line, size_t length)
+    {
+        std::string header(reinterpret_cast<const char *>(line), length);
+        if (!headerRead)
+        {
+            linesNeeded = 1;
+            return true;
+        }
+        if (sscanf(header.c_str(), "#B %c %ld %ld", &blockKind, &blockFirst, &blockSecond) != 3)
+        {
+            std::cerr << "Error: Malformed block header in encoded file.\n";
+            return false;
+        }
+        if (blockKind == 'T')
+        {
+            if (blockFirst < 0 || blockFirst >= numTables)
+            {
+                std::cerr << "Error: Block refers to code table " << blockFirst << " which was not supplied.\n";
+                return false;
+            }
+            linesNeeded = 2;
+        }
+        else
+        {
+            if (blockSecond < 0 || blockSecond > NUM_CHARACTERS)
+            {
+                std::cerr << "Error: Malformed block table in encoded file.\n";
+                return false;
+            }
+            linesNeeded = blockSecond + 2;
+        }
+        return true;
+    }
+
+    bool decodeUnit(const uint8_t *unit, size_t length, std::vector<uint8_t> &out)
+    {
+        if (!headerRead)
+        {
+            headerRead = true;
+            return true;
+        }
+
+        long numSymbols, consumed;
+        size_t bitsLength = length - bitsStart - 1; // without the block terminator
+        size_t before = out.size();
+        if (blockKind == 'T')
+        {
+            numSymbols = blockSecond;
+            consumed = decoders[blockFirst]->decodeBuffer(unit + bitsStart, bitsLength, out, numSymbols);
+        }
+        else
+        {
+            std::unique_ptr<EntropyCoder> coder(EntropyCoder::create(blockKind));
+            if (!coder)
+            {
+                std::cerr << "Error: Unknown block type '" << blockKind << "' in encoded file.\n";
+                return false;
+            }
+            if (!coder->parse(reinterpret_cast<const char *>(unit + tableStart), bitsStart - tableStart))
+            {
+                std::cerr << "Error: Malformed block table in encoded file.\n";
+                return false;
+            }
+            numSymbols = blockFirst;
+            consumed = coder->decode(unit + bitsStart, bitsLength, numSymbols, out);
+        }
+
+        if (consumed != static_cast<long>(bitsLength) || static_cast<long>(out.size() - before) != numSymbols)
+        {
+            std::cerr << "Error: Truncated or corrupt block in encoded file.\n";
+            return false;
+        }
+        return true;
+    }
+
+    const HuffmanDecoder *const *decoders;
+    int numTables;
+    Kind kind;
+
+    // Plain and run-length streams.
+    DecodeState state;
+    RunLengthDecoder runLengthDecoder;
+    std::vector<uint8_t> transformed;
+
+    // Block streams. Offsets are relative to the start of the current unit.
+    std::vector<uint8_t> pending;
+    bool headerRead;
+    size_t scanned;
+    long linesSeen;
+    long linesNeeded;
+    size_t tableStart;
+    size_t bitsStart;
+    char blockKind;
+    long blockFirst;
+    long blockSecond;
+};
+
+bool HuffmanEncoding::decode(const uint8_t *data, size_t size, const HuffmanCodeTable &table, std::vector<uint8_t> &out)
+{
+    out.clear();
+    StreamDecoder streamDecoder(&table.decoder, 1);
+    return streamDecoder.decode(data, size, out) && streamDecoder.finish(out);
+}
+
+/**
+ * Decode encodedFile into outputFile through the stream pipeline.
+ * Returns false if the stream is malformed or the files cannot be read or written.
+ */
+bool decodeFile(FILE *encodedFile, FILE *outputFile, const HuffmanDecoder *const *decoders, int numTables)
+{
+    StreamDecoder streamDecoder(decoders, numTables);
+    bool decoded = StreamPipeline::run(encodedFile, outputFile,
+        [&](const uint8_t *data, size_t length, std::vector<uint8_t> &out)
+        {
+            return streamDecoder.decode(data, length, out);
+        });
+    // A run at the very end is only complete once the stream has ended.
+    std::vector<uint8_t> rest;
+    return decoded && streamDecoder.finish(rest) && fwrite(rest.data(), 1, rest.size(), outputFile) == rest.size();
+}
+
+void HuffmanEncoding::decodeTextMultiTable(char *testEncodedFilePath, char **huffmanCodeFilePaths, int numTables, char *resultFilePath)
+{
+    std::unique_ptr<HuffmanCodeTable[]> tables(new HuffmanCodeTable[numTables]);
+    std::vector<const HuffmanDecoder *> decoders;
+    for (int t = 0; t < numTables; ++t)
+    {
+        if (!tables[t].loadForDecoding(huffmanCodeFilePaths[t]))
+        {
+            std::cerr << "Error: Unable to open Huffman code file " << huffmanCodeFilePaths[t] << ".\n";
+            return;
+        }
+        decoders.push_back(tables[t].decoder);
+    }
+
+    FILE *encodedFile = fopen(testEncodedFilePath, "rb");
+    if (!encodedFile)
+    {
+        std::cerr << "Error: Unable to open input encoded file.\n";
+        return;
+    }
+
+    FILE *outputFile = fopen(resultFilePath, "wb");
+    if (!outputFile)
+    {
+        std::cerr << "Error: Unable to open output decoded file.\n";
+        fclose(encodedFile);
+        return;
+    }
+
+    if (!decodeFile(encodedFile, outputFile, decoders.data(), numTables))
+        std::cerr << "Error: Truncated or corrupt encoded file.\n";
+
+    fclose(encodedFile);
+    fclose(outputFile);
+}
+
+void HuffmanEncoding::decodeText(char *testEncodedFilePath, char *huffmanCodeFilePath, char *resultFilePath)
+{
+    HuffmanCodeTable table;
+    if (!table.loadForDecoding(huffmanCodeFilePath))
+    {
+        std::cerr << "Error: Unable to open Huffman code file.\n";
+        return;
+    }
+
+    FILE *encodedFile = fopen(testEncodedFilePath, "rb");
+    if (!encodedFile)
+    {
+        std::cerr << "Error: Unable to open input encoded file.\n";
+        return;
+    }
+
+    FILE *outputFile = fopen(resultFilePath, "wb");
+    if (!outputFile)
+    {
+        std::cerr << "Error: Unable to open output decoded file.\n";
+        fclose(encodedFile);
+        return;
+    }
+
+    if (!decodeFile(encodedFile, outputFile, &table.decoder, 1))
+        std::cerr << "Error: Truncated or corrupt encoded file.\n";
+
+    fclose(encodedFile);
+    fclose(outputFile);
+}
+
+/*
+ * Parallel decoding of a stream without usable boundaries. The bits are cut into chunks
+ * and every thread decodes a chunk as if a code started at its first bit. Huffman codes
+ * resynchronize quickly: once a misaligned decode ends a code on a real boundary it
+ * stays aligned. Each thread also decodes PARALLEL_SYNC_WINDOW bits past the end of its
+ * chunk; the first boundary that this overrun shares with the next chunk's decode is
+ * where the next chunk's output becomes valid. If the two never meet inside the window,
+ * the next chunk is decoded again from the last known boundary.
+ *
+ * Chunks are decoded in rounds of one chunk per thread, and a round is written as soon
+ * as it is joined to the next, so memory use depends on the chunk size and the number of
+ * threads but not on the stream size. A chunk is less than twice PARALLEL_MAX_CHUNK bits.
+ */
+const size_t PARALLEL_SYNC_WINDOW = 1 << 14;
+const size_t PARALLEL_MIN_CHUNK = 1 << 20;
+const size_t PARALLEL_MAX_CHUNK = 1 << 24;
+
+void HuffmanEncoding::decodeTextParallel(char *testEncodedFilePath, char *huffmanCodeFilePath, char *resultFilePath, int numThreads)
+{
+    HuffmanCodeTable table;
+    if (!table.loadForDecoding(huffmanCodeFilePath))
+    {
+        std::cerr << "Error: Unable to open Huffman code file.\n";
+        return;
+    }
+
+    MappedFile encoded;
+    if (!encoded.open(testEncodedFilePath))
+    {
+        std::cerr << "Error: Unable to open input encoded file.\n";
+        return;
+    }
+    const uint8_t *data = encoded.data();
+    size_t size = encoded.size();
+
+    if (size >= 11 && memcmp(data, "#HUFFBLOCKS", 11) == 0)
+    {
+        // Block headers already cut the stream; there is nothing to speculate about.
+        encoded.close();
+        decodeText(testEncodedFilePath, huffmanCodeFilePath, resultFilePath);
+        return;
+    }
+
+    // data is NULL for an empty file, so it is only searched when there is something to search.
+    bool isRunLength = size >= RUN_LENGTH_HEADER_LENGTH && memcmp(data, RUN_LENGTH_HEADER, RUN_LENGTH_HEADER_LENGTH) == 0;
+    bool isIndexed = size >= SEEK_INDEX_MAGIC_LENGTH && memcmp(data, SEEK_INDEX_MAGIC, SEEK_INDEX_MAGIC_LENGTH) == 0;
+    size_t start = 0;
+    if (size > 0 && data[0] == '#')
+    {
+        const uint8_t *headerEnd = static_cast<const uint8_t *>(memchr(data, '\n', size));
+        start = headerEnd ? headerEnd - data + 1 : size;
+    }
+    const uint8_t *bitsEnd = (start < size) ? static_cast<const uint8_t *>(memchr(data + start, '\n', size - start)) : NULL;
+    size_t end = bitsEnd ? bitsEnd - data : size;
+    // Only the seek index may follow the bits, as in decodeText.
+    if ((bitsEnd != NULL) != isIndexed)
+    {
+        std::cerr << "Error: Truncated or corrupt encoded file.\n";
+        return;
+    }
+
+    FILE *outputFile = fopen(resultFilePath, "wb");
+    if (!outputFile)
+    {
+        std::cerr << "Error: Unable to open output decoded file.\n";
+        return;
+    }
+
+    if (numThreads <= 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t chunkSize = std::min(std::max((end - start) / numThreads, PARALLEL_MIN_CHUNK), PARALLEL_MAX_CHUNK);
+    // The last chunk also takes the remainder, so no chunk is shorter than the sync window.
+    size_t numChunks = (end == start) ? 0 : std::max<size_t>(1, (end - start) / chunkSize);
+    auto chunkStart = [&](size_t c) { return (c < numChunks) ? start + c * chunkSize : end; };
+    auto windowEnd = [&](size_t c) { return (c + 1 < numChunks) ? std::min(chunkStart(c + 1) + PARALLEL_SYNC_WINDOW, end) : end; };
+
+    RunLengthDecoder runLengthDecoder;
+    std::vector<uint8_t> text;
+    bool corrupt = false, written = true;
+    auto writeText = [&](const uint8_t *chunkText, size_t length)
+    {
+        if (isRunLength)
+        {
+            text.clear();
+            if (!runLengthDecoder.decode(chunkText, length, text))
+            {
+                corrupt = true;
+                return;
+            }
+            chunkText = text.data();
+            length = text.size();
+        }
+        written = fwrite(chunkText, 1, length, outputFile) == length;
+    };
+
+    // spans[0] holds the last chunk of the previous round, which is written once it is
+    // joined to the first chunk of the current round. Characters [first[i], last) of
+    // spans[i] belong to the output. validFrom is the first bit from which the current
+    // chunk's decode is known to be aligned.
+    std::vector<SpanDecode> spans(numThreads + 1);
+    std::vector<size_t> first(numThreads + 1, 0);
+    const HuffmanDecoder *decoder = table.decoder;
+    size_t validFrom = start;
+    int resynchronized = 0;
+    for (size_t roundStart = 0; roundStart < numChunks && !corrupt && written; roundStart += numThreads)
+    {
+        size_t roundSize = std::min<size_t>(numThreads, numChunks - roundStart);
+        // One phase per thread, see CodecPhase.
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < roundSize; ++t)
+        {
+            threads.push_back(std::thread([&, t]()
+                                          {
+                size_t c = roundStart + t;
+                CodecPhase phase("decode");
+                phase.bytes = windowEnd(c) - chunkStart(c);
+                decoder->decodeSpan(data, chunkStart(c), chunkStart(c + 1), windowEnd(c), PARALLEL_SYNC_WINDOW, spans[t + 1]); }));
+        }
+        for (size_t t = 0; t < roundSize; ++t)
+            threads[t].join();
+
+        // The first chunk of the stream starts on a real boundary.
+        if (roundStart == 0)
+            first[1] = 0;
+        for (size_t i = (roundStart == 0) ? 1 : 0; i < roundSize && !corrupt && written; ++i)
+        {
+            SpanDecode &span = spans[i];
+            SpanDecode &next = spans[i + 1];
+            size_t nextChunk = roundStart + i;
+            if (span.badCharacter || span.lastInvalidBit >= static_cast<long long>(validFrom) || span.overrun.empty())
+            {
+                corrupt = true;
+                break;
+            }
+
+            size_t a = 0, b = 0;
+            while (a < span.overrun.size() && b < next.head.size() && span.overrun[a].first != next.head[b].first)
+            {
+                if (span.overrun[a].first < next.head[b].first)
+                    ++a;
+                else
+                    ++b;
+            }
+            size_t last;
+            if (a < span.overrun.size() && b < next.head.size())
+            {
+                last = span.overrun[a].second;
+                first[i + 1] = next.head[b].second;
+                validFrom = span.overrun[a].first;
+            }
+            else
+            {
+                last = span.overrun.back().second;
+                validFrom = span.overrun.back().first;
+                decoder->decodeSpan(data, validFrom, chunkStart(nextChunk + 1), windowEnd(nextChunk), 0, next);
+                first[i + 1] = 0;
+                resynchronized++;
+            }
+            writeText(span.out.data() + first[i], last - first[i]);
+        }
+        std::swap(spans[0], spans[roundSize]);
+        first[0] = first[roundSize];
+    }
+
+    // The last chunk must end on a code boundary at the end of the bits.
+    if (numChunks > 0 && !corrupt && written)
+    {
+        SpanDecode &span = spans[0];
+        if (span.badCharacter || span.lastInvalidBit >= static_cast<long long>(validFrom) || span.overrun.empty() ||
+            span.overrun.back().first != end)
+            corrupt = true;
+        else
+            writeText(span.out.data() + first[0], span.overrun.back().second - first[0]);
+    }
+    if (isRunLength && !corrupt && written)
+    {
+        text.clear();
+        if (!runLengthDecoder.finish(text))
+            corrupt = true;
+        else
+            written = fwrite(text.data(), 1, text.size(), outputFile) == text.size();
+    }
+    LogManager::writePrintfToLog(LogManager::Level::Status, "HuffmanEncoding::decodeTextParallel",
+                                 "%d chunks, %d decoded again after a failed resynchronization", (int)numChunks, resynchronized);
+    if (corrupt)
+        std::cerr << "Error: Truncated or corrupt encoded file.\n";
+    else if (!written)
+        std::cerr << "Error: Unable to write output decoded file.\n";
+    fclose(outputFile);
+}
+
+void HuffmanEncoding::decodeRange(char *testEncodedFilePath, char *huffmanCodeFilePath, long offset, long length, char *resultFilePath)
+{
+    HuffmanCodeTable table;
+    if (!table.loadForDecoding(huffmanCodeFilePath))
+    {
+        std::cerr << "Error: Unable to open Huffman code file.\n";
+        return;
+    }
+
+    FILE *encodedFile = fopen(testEncodedFilePath, "rb");
+    if (!encodedFile)
+    {
+        std::cerr << "Error: Unable to open input encoded file.\n";
+        return;
+    }
+    char tag[11];
+    size_t tagLength = fread(tag, 1, sizeof(tag), encodedFile);
+    rewind(encodedFile);
+    bool isBlockStream = tagLength == sizeof(tag) && memcmp(tag, "#HUFFBLOCKS", sizeof(tag)) == 0;
+    bool isRunLength = tagLength >= RUN_LENGTH_HEADER_LENGTH && memcmp(tag, RUN_LENGTH_HEADER, RUN_LENGTH_HEADER_LENGTH) == 0;
+    bool isIndexed = tagLength >= SEEK_INDEX_MAGIC_LENGTH && memcmp(tag, SEEK_INDEX_MAGIC, SEEK_INDEX_MAGIC_LENGTH) == 0;
+    if (tagLength > 0 && tag[0] == '#' && !isBlockStream && !isRunLength && !isIndexed)
+    {
+        std::cerr << "Error: Unsupported encoded file format.\n";
+        fclose(encodedFile);
+        return;
+    }
+    if (!isBlockStream && !isRunLength)
+    {
+        fclose(encodedFile);
+        table.decoder->decodeRange(testEncodedFilePath, offset, length, resultFilePath);
+        return;
+    }
+
+    FILE *outputFile = fopen(resultFilePath, "wb");
+    if (!outputFile)
+    {
+        std::cerr << "Error: Unable to open output decoded file.\n";
+        fclose(encodedFile);
+        return;
+    }
+
+    // Character offsets do not map to positions in a run-length transformed stream or
+    // a block stream, so the stream is decoded from the start and the range cut out
+    // of the text. Reading stops once the range is complete.
+    const size_t first = std::max(offset, 0L);
+    const size_t last = first + std::max(length, 0L);
+    StreamDecoder streamDecoder(&table.decoder, 1);
+    std::vector<uint8_t> chunk(StreamPipeline::DEFAULT_CHUNK_SIZE), text;
+    size_t position = 0; // characters decoded before text
+    bool decoded = true, ended = false;
+    while (decoded && position < last && !ended)
+    {
+        text.clear();
+        size_t chunkLength = fread(chunk.data(), 1, chunk.size(), encodedFile);
+        ended = chunkLength < chunk.size();
+        decoded = streamDecoder.decode(chunk.data(), chunkLength, text) && (!ended || streamDecoder.finish(text));
+        size_t begin = std::max(first, position), end = std::min(last, position + text.size());
+        if (begin < end)
+            fwrite(text.data() + (begin - position), 1, end - begin, outputFile);
+        position += text.size();
+    }
+    if (!decoded)
+        std::cerr << "Error: Truncated or corrupt encoded file.\n";
+
+    fclose(encodedFile);
+    fclose(outputFile);
 }
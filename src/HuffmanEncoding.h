@@ -10,13 +10,96 @@
 #include <fstream>
 #include <limits.h>
 #include <math.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <string>
+#include <vector>
 #include "util/GetMemUsage.h"
 #include "util/LogManager.h"
 
+class HuffmanDecoder;
+
+/**
+ * Alphabet Huffman code table, as written by HuffmanEncoding::generateAlphabetCode,
+ * held in memory together with its decoding trie so that it can be reused for any
+ * number of encode and decode calls.
+ */
+class HuffmanCodeTable{
+
+public:
+	static const int NUM_CHARACTERS = 128;
+
+	HuffmanCodeTable();
+	~HuffmanCodeTable();
+
+	/**
+	 * Read the table from a Huffman code file. Returns false if the file cannot be read.
+	 */
+	bool load(const char* huffmanCodeFilePath);
+
+	/**
+	 * Load only what decoding needs. If the decode table file written next to the code
+	 * file by HuffmanEncoding::generateDecodeTable is valid for it, the table is memory
+	 * mapped and used in place; otherwise the code file is read as by load. The codes
+	 * are not available when the decode table file is used, so a table loaded this way
+	 * must not be used for encoding.
+	 *
+	 * Returns false if neither file can be read.
+	 */
+	bool loadForDecoding(const char* huffmanCodeFilePath);
+
+	/**
+	 * Read the table from the contents of a Huffman code file held in memory.
+	 * Returns false if the text is malformed.
+	 */
+	bool parse(const char* text, size_t length);
+
+	/**
+	 * Returns true if the table has a code for the character.
+	 */
+	bool hasCode(int character) const;
+
+	/**
+	 * Returns the code of the character as a string of '0' and '1'.
+	 */
+	const std::string& getCode(int character) const;
+
+private:
+	friend class HuffmanEncoding;
+	friend class HuffmanCoder;
+
+	HuffmanCodeTable(const HuffmanCodeTable&);
+	HuffmanCodeTable& operator=(const HuffmanCodeTable&);
+
+	std::string codes[NUM_CHARACTERS];
+	HuffmanDecoder* decoder;
+};
+
 class HuffmanEncoding{
 
 public:
+	/**
+	 * Size and entropy figures computed by estimateEncoding.
+	 */
+	struct EncodingEstimate{
+		long long numCharacters;   // characters in the input file
+		long long encodedBits;     // exact number of code bits encodeText would write
+		long long encodedBytes;    // exact size of the file encodeText would write, header included
+		double entropyBits;        // Shannon entropy of the coded symbols, in bits per input character
+		double averageCodeLength;  // encodedBits / numCharacters
+		bool encodable;            // false if some coded symbol has no code
+		bool runLength;            // encodeText would apply the run-length transform
+	};
+
+	/**
+	 * Entropy coders encodeTextMultiTable may use for a block.
+	 */
+	enum EntropyBackend{
+		BACKEND_HUFFMAN, // pretrained or fresh Huffman tables
+		BACKEND_TANS,    // fresh tANS tables for every block
+		BACKEND_AUTO     // whichever of the above is smallest, chosen per block
+	};
+
 	/**
 	 * Given an input text file, obtain frequencies of alphabets and generate HuffmanCode.
 	 *
@@ -28,6 +111,30 @@ public:
 	 */
 	static void generateAlphabetCode(char* trainFilePath, char* resultFilePath);
 
+	/**
+	 * Generate one HuffmanCode from the summed histograms of many training files.
+	 * Histograms are built concurrently, one file per worker at a time, so at most
+	 * numThreads files are open at once. The run-length transform is decided and applied
+	 * per file, as encodeText would for each of them. The table therefore matches
+	 * generateAlphabetCode on the concatenation only when no file takes the transform.
+	 *
+	 * @param corpusPath A directory, searched recursively, or a glob pattern.
+	 * @param resultFilePath Path of the output Huffman code file.
+	 * @param numThreads Number of worker threads, 0 for one per hardware thread.
+	 */
+	static void generateCorpusCode(char* corpusPath, char* resultFilePath, int numThreads = 0);
+
+	/**
+	 * Write the decode trie of a code file, flattened into an array of nodes, to the
+	 * decode table file huffmanCodeFilePath + ".dtab". The decoders map that file instead
+	 * of building the trie from the code file. The file holds a version, a checksum and
+	 * the size and modification time of the code file, and is ignored if any of them do
+	 * not match. generateAlphabetCode and generateCorpusCode call this for their output.
+	 *
+	 * @param huffmanCodeFilePath Path of the alphabet Huffman code file.
+	 */
+	static void generateDecodeTable(char* huffmanCodeFilePath);
+
 
 	/**
 	 * Given an input text file and a file contain the HuffmanCode for alphabets, generate
@@ -36,11 +143,13 @@ public:
 	 * @param testASCIIFilePath Path of the input file.
 	 * @param huffmanCodeFilePath Path of the alphabet Huffman code file.
 	 * @param resultFilePath Path of the output encoded file.
+	 * @param seekIndexInterval If positive, append a seek index with one checkpoint every
+	 * seekIndexInterval input characters so that decodeRange can start near the range.
 	 *
 	 * If the input file cannot be read throw an error of type ios_base::failure
 	 * If the output file cannot be generated, then throw an error of type ios_base::failure
 	 */
-	static void encodeText(char* testASCIIFilePath, char* huffmanCodeFilePath, char* resultFilePath);
+	static void encodeText(char* testASCIIFilePath, char* huffmanCodeFilePath, char* resultFilePath, int seekIndexInterval = 0);
 
 	/**
 	 * Given an input encoded file and a file contain the HuffmanCode for alphabets, generate
@@ -55,6 +164,127 @@ public:
 	 */
 	static void decodeText(char* testEncodedFilePath, char* huffmanCodeFilePath, char* resultFilePath);
 
+	/**
+	 * Decode a file like decodeText, using several threads even though the stream has no
+	 * index. Threads start at arbitrary bit offsets and the outputs are joined where their
+	 * decodes resynchronize. The chunks are decoded and written in rounds of one per
+	 * thread, so memory use does not grow with the stream. Block streams are decoded serially.
+	 *
+	 * @param testEncodedFilePath Path of the input encoded file.
+	 * @param huffmanCodeFilePath Path of the alphabet Huffman code file.
+	 * @param resultFilePath Path of the output decoded file.
+	 * @param numThreads Number of threads, 0 for one per hardware thread.
+	 */
+	static void decodeTextParallel(char* testEncodedFilePath, char* huffmanCodeFilePath, char* resultFilePath, int numThreads = 0);
+
+	/**
+	 * Encode a buffer in memory. The output is identical to the file written by encodeText.
+	 *
+	 * @param data Input text.
+	 * @param size Number of bytes in data.
+	 * @param table Alphabet Huffman code table.
+	 * @param out Receives the encoded stream.
+	 * @param seekIndexInterval If positive, append a seek index as encodeText does.
+	 *
+	 * Returns false if a character of the input has no code in the table.
+	 */
+	static bool encode(const uint8_t* data, size_t size, const HuffmanCodeTable& table, std::vector<uint8_t>& out, int seekIndexInterval = 0);
+
+	/**
+	 * Decode a buffer in memory holding any stream that decodeText accepts.
+	 *
+	 * @param data Encoded stream.
+	 * @param size Number of bytes in data.
+	 * @param table Alphabet Huffman code table.
+	 * @param out Receives the decoded text.
+	 *
+	 * Returns false if the stream is malformed; out then holds the text decoded so far.
+	 */
+	static bool decode(const uint8_t* data, size_t size, const HuffmanCodeTable& table, std::vector<uint8_t>& out);
+
+	/**
+	 * Decode length characters starting at character offset of the original text. If the
+	 * encoded file has a seek index, decoding starts from the nearest checkpoint before
+	 * offset, otherwise from the beginning of the stream.
+	 *
+	 * @param testEncodedFilePath Path of the input encoded file.
+	 * @param huffmanCodeFilePath Path of the alphabet Huffman code file.
+	 * @param offset Offset of the first character to decode.
+	 * @param length Number of characters to decode.
+	 * @param resultFilePath Path of the output decoded file.
+	 */
+	static void decodeRange(char* testEncodedFilePath, char* huffmanCodeFilePath, long offset, long length, char* resultFilePath);
+
+	/**
+	 * Compute the exact encoded size, the Shannon entropy and, optionally, a per character
+	 * code length report for an input file from its histogram and the code lengths alone.
+	 * Like encodeText without a seek index, the histogram is taken after the run-length
+	 * transform when encodeText would apply it. No output file is written.
+	 *
+	 * @param testASCIIFilePath Path of the input file.
+	 * @param huffmanCodeFilePath Path of the alphabet Huffman code file.
+	 * @param printReport If true, print the per character report to stdout.
+	 *
+	 * If either file cannot be read, an estimate with encodable set to false is returned.
+	 */
+	static EncodingEstimate estimateEncoding(char* testASCIIFilePath, char* huffmanCodeFilePath, bool printReport);
+
+	/**
+	 * Given an input text file and several pretrained HuffmanCode files, encode the text
+	 * block by block. Each block uses the table that gives the smallest output for the
+	 * block's histogram, or a freshly built table stored in the block header when that
+	 * saves more than the header costs. The choice is recorded in each block header.
+	 *
+	 * @param testASCIIFilePath Path of the input file.
+	 * @param huffmanCodeFilePaths Paths of the pretrained alphabet Huffman code files.
+	 * @param numTables Number of entries in huffmanCodeFilePaths.
+	 * @param resultFilePath Path of the output encoded file.
+	 * @param blockSize Number of input characters per block, 0 for the default.
+	 * @param backend Entropy coders to choose from. Pretrained tables are ignored for BACKEND_TANS.
+	 */
+	static void encodeTextMultiTable(char* testASCIIFilePath, char** huffmanCodeFilePaths, int numTables, char* resultFilePath, int blockSize,
+									 EntropyBackend backend = BACKEND_HUFFMAN);
+
+	/**
+	 * Decode a file generated by encodeTextMultiTable. The code files must be given in the
+	 * same order as when encoding.
+	 *
+	 * @param testEncodedFilePath Path of the input encoded file.
+	 * @param huffmanCodeFilePaths Paths of the pretrained alphabet Huffman code files.
+	 * @param numTables Number of entries in huffmanCodeFilePaths.
+	 * @param resultFilePath Path of the output decoded file.
+	 */
+	static void decodeTextMultiTable(char* testEncodedFilePath, char** huffmanCodeFilePaths, int numTables, char* resultFilePath);
+
+	/**
+	 * Given an input text file, split it into word and separator tokens and generate a
+	 * Huffman code over the tokens. Tokens seen at least twice form the vocabulary, which
+	 * is written to the code file together with a code for every single byte.
+	 *
+	 * @param trainFilePath Path of the input file.
+	 * @param resultFilePath Path of the output token code file.
+	 */
+	static void generateTokenCode(char* trainFilePath, char* resultFilePath);
+
+	/**
+	 * Encode a text file token by token. Tokens that are not in the vocabulary are
+	 * encoded one byte at a time.
+	 *
+	 * @param testASCIIFilePath Path of the input file.
+	 * @param tokenCodeFilePath Path of the token code file written by generateTokenCode.
+	 * @param resultFilePath Path of the output encoded file.
+	 */
+	static void encodeTokens(char* testASCIIFilePath, char* tokenCodeFilePath, char* resultFilePath);
+
+	/**
+	 * Decode a file generated by encodeTokens.
+	 *
+	 * @param testEncodedFilePath Path of the input encoded file.
+	 * @param tokenCodeFilePath Path of the token code file used for encoding.
+	 * @param resultFilePath Path of the output decoded file.
+	 */
+	static void decodeTokens(char* testEncodedFilePath, char* tokenCodeFilePath, char* resultFilePath);
+
 };
 
 #endif /* HUFFMANENCODING_H_ */
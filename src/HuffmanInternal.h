@@ -0,0 +1,67 @@
+/*
+ * HuffmanInternal.h
+ *
+ * Helpers shared by the codec translation units. Not part of the public API.
+ */
+
+#ifndef HUFFMANINTERNAL_H_
+#define HUFFMANINTERNAL_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "util/AllocTracker.h"
+#include "util/PerfCounters.h"
+
+/**
+ * Scoped codec phase for the performance counters and the allocation tracker.
+ * Set bytes before the scope ends so the counters can be reported per byte processed.
+ * Work spread over threads opens a phase in each thread: allocations are attributed to
+ * the calling thread's phases, and the performance counters only follow the thread that
+ * enabled them, so the other threads are left out of the counter report.
+ */
+struct CodecPhase
+{
+    const char *name;
+    long long bytes;
+
+    CodecPhase(const char *phaseName) : name(phaseName), bytes(0)
+    {
+        AllocTracker::beginPhase(name);
+        PerfCounters::beginPhase(name);
+    }
+
+    ~CodecPhase()
+    {
+        PerfCounters::endPhase(name, bytes);
+        AllocTracker::endPhase();
+    }
+};
+
+/**
+ * Split a code file line of the form "character" "probability" "code" into its fields.
+ * Fields that cannot be found are left empty. Each output must hold strlen(line) + 1 bytes.
+ */
+void parseLine(const char *line, char *character, char *prob, char *code);
+
+/**
+ * Format one line of a code file. The newline character is written as \n.
+ */
+std::string formatCodeLine(char character, double probability, const std::string &code);
+
+/**
+ * Character described by the first field of a code file line, or -1 if the field is empty.
+ */
+int codeLineCharacter(const char *character);
+
+/**
+ * Read a whole file into data. Returns false if the file cannot be opened.
+ */
+bool readWholeFile(const char *filePath, std::vector<uint8_t> &data);
+
+/**
+ * Write data to a file, replacing it. Returns false if the file cannot be written.
+ */
+bool writeWholeFile(const char *filePath, const std::vector<uint8_t> &data);
+
+#endif /* HUFFMANINTERNAL_H_ */
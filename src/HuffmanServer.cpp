@@ -0,0 +1,469 @@
+#include "HuffmanServer.h"
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+
+// Idle workers wake up this often to notice stop() and expired connections.
+#define SERVER_POLL_INTERVAL_MS 100
+// Smallest number of bytes requested from a connection per recv call.
+#define SERVER_RECEIVE_SIZE (64 * 1024)
+// An idle connection keeps a receive buffer at most this large.
+#define SERVER_IDLE_BUFFER_SIZE (1 << 20)
+
+struct HuffmanServer::Connection
+{
+    int socket;
+    std::vector<uint8_t> received; // the next request, possibly incomplete
+    long long lastRequestMs;       // when the last request was answered or the connection accepted
+    long long requestStartMs;      // when the first byte of the next request arrived, 0 if none has
+    bool busy;                     // a worker is serving the connection
+};
+
+namespace
+{
+
+// epoll event id of the listening socket; connection ids start at 1.
+const uint64_t LISTEN_ID = 0;
+
+long long steadyMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Read exactly length bytes. Returns false on end of stream or an error.
+ */
+bool readFully(int fd, void *buffer, size_t length)
+{
+    uint8_t *position = static_cast<uint8_t *>(buffer);
+    while (length > 0)
+    {
+        ssize_t n = recv(fd, position, length, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        position += n;
+        length -= n;
+    }
+    return true;
+}
+
+/**
+ * Send header and payload with one gather write, so the payload is handed to the
+ * kernel straight from the caller's buffer. On a non-blocking socket, waits for it to
+ * become writable until deadlineMs on the steadyMs clock. Returns false on an error
+ * or when the deadline passes.
+ */
+bool sendGather(int fd, const void *header, size_t headerLength, const void *payload, size_t payloadLength, long long deadlineMs = 0)
+{
+    struct iovec parts[2];
+    parts[0].iov_base = const_cast<void *>(header);
+    parts[0].iov_len = headerLength;
+    parts[1].iov_base = const_cast<void *>(payload);
+    parts[1].iov_len = payloadLength;
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = payloadLength > 0 ? 2 : 1;
+    while (message.msg_iovlen > 0)
+    {
+        ssize_t n = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            long long remaining = deadlineMs - steadyMs();
+            struct pollfd waitFor = {fd, POLLOUT, 0};
+            if (remaining <= 0 || (poll(&waitFor, 1, static_cast<int>(remaining)) < 0 && errno != EINTR))
+                return false;
+            continue;
+        }
+        if (n < 0)
+            return false;
+        // Skip what was sent; a short write can end inside either part.
+        while (message.msg_iovlen > 0 && (size_t)n >= message.msg_iov->iov_len)
+        {
+            n -= message.msg_iov->iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen > 0)
+        {
+            message.msg_iov->iov_base = static_cast<uint8_t *>(message.msg_iov->iov_base) + n;
+            message.msg_iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+bool fillSocketAddress(const char *socketPath, struct sockaddr_un &address)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path))
+        return false;
+    strcpy(address.sun_path, socketPath);
+    return true;
+}
+
+}
+
+HuffmanServer::HuffmanServer() : listenSocket(-1), epollFd(-1), stopping(false), requests(0), nextConnectionId(LISTEN_ID + 1), nextExpiryCheck(0)
+{
+}
+
+HuffmanServer::~HuffmanServer()
+{
+    stop();
+}
+
+bool HuffmanServer::addTable(const std::string &name, const char *huffmanCodeFilePath)
+{
+    if (name.empty() || name.size() > 255 || !workers.empty())
+        return false;
+    std::unique_ptr<HuffmanCodeTable> table(new HuffmanCodeTable());
+    if (!table->load(huffmanCodeFilePath))
+        return false;
+    tables[name] = std::move(table);
+    return true;
+}
+
+bool HuffmanServer::start(const char *path, int numWorkers)
+{
+    struct sockaddr_un address;
+    if (listenSocket >= 0 || numWorkers < 1 || !fillSocketAddress(path, address))
+        return false;
+
+    listenSocket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (listenSocket < 0)
+        return false;
+    unlink(path);
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = LISTEN_ID;
+    if (epollFd < 0 || bind(listenSocket, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listenSocket, 128) != 0 ||
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenSocket, &event) != 0)
+    {
+        if (epollFd >= 0)
+            close(epollFd);
+        close(listenSocket);
+        epollFd = -1;
+        listenSocket = -1;
+        return false;
+    }
+    socketPath = path;
+
+    LogManager::writePrintfToLog(LogManager::Level::Status, "HuffmanServer::start",
+                                 "Serving %d tables on %s with %d workers.", (int)tables.size(), path, numWorkers);
+    stopping = false;
+    for (int w = 0; w < numWorkers; ++w)
+        workers.push_back(std::thread(&HuffmanServer::workerLoop, this));
+    return true;
+}
+
+void HuffmanServer::stop()
+{
+    if (listenSocket < 0)
+        return;
+    stopping = true;
+    for (size_t w = 0; w < workers.size(); ++w)
+        workers[w].join();
+    workers.clear();
+    for (std::map<uint64_t, std::unique_ptr<Connection> >::iterator c = connections.begin(); c != connections.end(); ++c)
+        close(c->second->socket);
+    connections.clear();
+    close(epollFd);
+    epollFd = -1;
+    close(listenSocket);
+    listenSocket = -1;
+    unlink(socketPath.c_str());
+    LogManager::writePrintfToLog(LogManager::Level::Status, "HuffmanServer::stop",
+                                 "Stopped after %lld requests.", requests.load());
+}
+
+long long HuffmanServer::requestCount() const
+{
+    return requests.load();
+}
+
+void HuffmanServer::workerLoop()
+{
+    // The response buffer lives as long as the worker, so steady state requests do
+    // not allocate once it has grown to the response size.
+    std::vector<uint8_t> response;
+    while (!stopping)
+    {
+        struct epoll_event event;
+        int ready = epoll_wait(epollFd, &event, 1, SERVER_POLL_INTERVAL_MS);
+        closeExpiredConnections();
+        if (ready <= 0)
+            continue;
+        if (event.data.u64 == LISTEN_ID)
+            acceptConnections();
+        else
+            serveConnection(event.data.u64, response);
+    }
+}
+
+void HuffmanServer::acceptConnections()
+{
+    // The listening socket is non-blocking, so a worker that loses the race for a
+    // connection gets EAGAIN and goes back to waiting.
+    int socket;
+    while ((socket = accept4(listenSocket, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0)
+    {
+        std::unique_ptr<Connection> connection(new Connection());
+        connection->socket = socket;
+        connection->lastRequestMs = steadyMs();
+        connection->requestStartMs = 0;
+        connection->busy = false;
+
+        // Connections are armed one event at a time, so exactly one worker serves a
+        // connection and rearms it when it is done. The mutex is held until the
+        // connection is in the map, in case its first event arrives right away.
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        uint64_t id = nextConnectionId++;
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.u64 = id;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, socket, &event) != 0)
+        {
+            close(socket);
+            continue;
+        }
+        connections[id] = std::move(connection);
+    }
+}
+
+void HuffmanServer::serveConnection(uint64_t id, std::vector<uint8_t> &response)
+{
+    Connection *connection;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        std::map<uint64_t, std::unique_ptr<Connection> >::iterator found = connections.find(id);
+        if (found == connections.end())
+            return;
+        connection = found->second.get();
+        connection->busy = true;
+    }
+
+    // Answer every complete request, then read whatever has arrived of the next one
+    // without waiting for the rest.
+    std::vector<uint8_t> &received = connection->received;
+    bool keepOpen = true;
+    while (keepOpen && !stopping)
+    {
+        size_t needed = sizeof(RequestHeader);
+        if (received.size() >= sizeof(RequestHeader))
+        {
+            RequestHeader header;
+            memcpy(&header, received.data(), sizeof(header));
+            if (header.payloadLength > MAX_PAYLOAD_LENGTH)
+            {
+                keepOpen = false;
+                break;
+            }
+            needed = sizeof(header) + header.nameLength + header.payloadLength;
+        }
+
+        if (received.size() >= needed)
+        {
+            keepOpen = answerRequest(*connection, response);
+            received.erase(received.begin(), received.begin() + needed);
+            connection->lastRequestMs = steadyMs();
+            connection->requestStartMs = received.empty() ? 0 : connection->lastRequestMs;
+            continue;
+        }
+
+        // The buffer grows with what has arrived rather than with the declared payload
+        // length, so a header alone cannot make the server allocate a gigabyte.
+        size_t have = received.size();
+        size_t wanted = std::max(std::min(needed - have, have), static_cast<size_t>(SERVER_RECEIVE_SIZE));
+        received.resize(have + wanted);
+        ssize_t n = recv(connection->socket, received.data() + have, wanted, 0);
+        received.resize(have + (n > 0 ? n : 0));
+        if (n > 0)
+        {
+            if (connection->requestStartMs == 0)
+                connection->requestStartMs = steadyMs();
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        keepOpen = false; // closed by the client or failed
+    }
+
+    if (!keepOpen)
+    {
+        closeConnection(id);
+        return;
+    }
+    if (received.empty() && received.capacity() > SERVER_IDLE_BUFFER_SIZE)
+        std::vector<uint8_t>().swap(received);
+
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    connection->busy = false;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.u64 = id;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->socket, &event) != 0)
+    {
+        close(connection->socket);
+        connections.erase(id);
+    }
+}
+
+bool HuffmanServer::answerRequest(Connection &connection, std::vector<uint8_t> &response)
+{
+    RequestHeader header;
+    memcpy(&header, connection.received.data(), sizeof(header));
+    const char *name = reinterpret_cast<const char *>(connection.received.data() + sizeof(header));
+    const uint8_t *payload = connection.received.data() + sizeof(header) + header.nameLength;
+
+    ResponseHeader reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.status = STATUS_OK;
+    response.clear();
+
+    std::map<std::string, std::unique_ptr<HuffmanCodeTable> >::const_iterator table = tables.find(std::string(name, header.nameLength));
+    if (header.operation == OP_LIST)
+    {
+        for (table = tables.begin(); table != tables.end(); ++table)
+        {
+            response.insert(response.end(), table->first.begin(), table->first.end());
+            response.push_back('\n');
+        }
+    }
+    else if (header.operation != OP_ENCODE && header.operation != OP_DECODE)
+        reply.status = STATUS_BAD_REQUEST;
+    else if (table == tables.end())
+        reply.status = STATUS_UNKNOWN_TABLE;
+    else if (header.operation == OP_ENCODE)
+    {
+        if (!HuffmanEncoding::encode(payload, header.payloadLength, *table->second, response))
+            reply.status = STATUS_FAILED;
+    }
+    else if (!HuffmanEncoding::decode(payload, header.payloadLength, *table->second, response))
+        reply.status = STATUS_FAILED;
+
+    if (reply.status != STATUS_OK)
+        response.clear();
+    reply.payloadLength = response.size();
+    if (!sendGather(connection.socket, &reply, sizeof(reply), response.data(), response.size(), steadyMs() + REQUEST_TIMEOUT_MS))
+        return false;
+    requests++;
+    return true;
+}
+
+void HuffmanServer::closeExpiredConnections()
+{
+    long long now = steadyMs();
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    if (now < nextExpiryCheck)
+        return;
+    nextExpiryCheck = now + SERVER_POLL_INTERVAL_MS;
+
+    // A connection being served is left alone; its worker rearms or closes it. The
+    // worker writes the timestamps without the lock, so they are read only when idle.
+    std::map<uint64_t, std::unique_ptr<Connection> >::iterator c = connections.begin();
+    while (c != connections.end())
+    {
+        const Connection &connection = *c->second;
+        if (connection.busy)
+        {
+            ++c;
+            continue;
+        }
+        bool idle = now - connection.lastRequestMs > IDLE_TIMEOUT_MS;
+        bool stalled = connection.requestStartMs != 0 && now - connection.requestStartMs > REQUEST_TIMEOUT_MS;
+        if (!idle && !stalled)
+        {
+            ++c;
+            continue;
+        }
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.socket, NULL);
+        close(connection.socket);
+        c = connections.erase(c);
+    }
+}
+
+void HuffmanServer::closeConnection(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    std::map<uint64_t, std::unique_ptr<Connection> >::iterator found = connections.find(id);
+    if (found == connections.end())
+        return;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, found->second->socket, NULL);
+    close(found->second->socket);
+    connections.erase(found);
+}
+
+HuffmanClient::HuffmanClient() : socket(-1)
+{
+}
+
+HuffmanClient::~HuffmanClient()
+{
+    if (socket >= 0)
+        close(socket);
+}
+
+bool HuffmanClient::connect(const char *socketPath)
+{
+    struct sockaddr_un address;
+    if (socket >= 0 || !fillSocketAddress(socketPath, address))
+        return false;
+    socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket < 0)
+        return false;
+    if (::connect(socket, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(socket);
+        socket = -1;
+        return false;
+    }
+    return true;
+}
+
+int HuffmanClient::request(char operation, const std::string &tableName, const uint8_t *payload, size_t length, std::vector<uint8_t> &out)
+{
+    out.clear();
+    if (socket < 0 || tableName.size() > 255 || length > HuffmanServer::MAX_PAYLOAD_LENGTH)
+        return -1;
+
+    // Header and name are small, so they are sent together from one buffer.
+    uint8_t head[sizeof(HuffmanServer::RequestHeader) + 255];
+    HuffmanServer::RequestHeader header;
+    memset(&header, 0, sizeof(header));
+    header.operation = operation;
+    header.nameLength = tableName.size();
+    header.payloadLength = length;
+    memcpy(head, &header, sizeof(header));
+    memcpy(head + sizeof(header), tableName.data(), tableName.size());
+    if (!sendGather(socket, head, sizeof(header) + tableName.size(), payload, length))
+        return -1;
+
+    HuffmanServer::ResponseHeader reply;
+    if (!readFully(socket, &reply, sizeof(reply)))
+        return -1;
+    out.resize(reply.payloadLength);
+    if (!readFully(socket, out.data(), out.size()))
+        return -1;
+    return reply.status;
+}
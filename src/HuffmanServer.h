@@ -0,0 +1,174 @@
+/*
+ * HuffmanServer.h
+ *
+ * Local encode/decode service. The server listens on a Unix domain socket and keeps
+ * its code tables, with their decode tries, loaded for its whole lifetime, so a
+ * request costs neither a process start nor a code file parse.
+ *
+ * Every request and response is a fixed header followed by its payload:
+ *
+ *   request:  RequestHeader, nameLength bytes of table name, payloadLength bytes
+ *   response: ResponseHeader, payloadLength bytes
+ *
+ * Fields are in host byte order since both ends run on the same machine. A
+ * connection may carry any number of requests one after another.
+ *
+ * Connections are non-blocking and share one epoll set. A worker takes a
+ * connection only while it has data, so idle connections do not hold workers.
+ */
+
+#ifndef HUFFMANSERVER_H_
+#define HUFFMANSERVER_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "HuffmanEncoding.h"
+
+class HuffmanServer{
+
+public:
+	enum Operation
+	{
+		OP_ENCODE = 'E', // payload is text, response is the encoded stream
+		OP_DECODE = 'D', // payload is any stream decodeText accepts, response is text
+		OP_LIST = 'L'    // no payload, response lists the table names, one per line
+	};
+
+	enum Status
+	{
+		STATUS_OK = 0,
+		STATUS_UNKNOWN_TABLE,
+		STATUS_BAD_REQUEST,
+		STATUS_FAILED      // the payload could not be encoded or decoded
+	};
+
+	struct RequestHeader
+	{
+		uint8_t operation;
+		uint8_t nameLength;
+		uint16_t reserved;
+		uint32_t payloadLength;
+	};
+
+	struct ResponseHeader
+	{
+		uint8_t status;
+		uint8_t reserved[3];
+		uint32_t payloadLength;
+	};
+
+	// Requests with a larger payload are rejected and the connection is closed.
+	static const uint32_t MAX_PAYLOAD_LENGTH = 1u << 30;
+	// Connections without a request for this long are closed.
+	static const int IDLE_TIMEOUT_MS = 60000;
+	// Connections are closed if a request is not received, or its response not sent,
+	// within this time.
+	static const int REQUEST_TIMEOUT_MS = 10000;
+
+	HuffmanServer();
+
+	/**
+	 * Calls stop().
+	 */
+	~HuffmanServer();
+
+	/**
+	 * Load a code file and serve it under name. Tables must be added before start().
+	 *
+	 * @param name Name clients use to select the table, at most 255 bytes.
+	 * @param huffmanCodeFilePath Path of the alphabet Huffman code file.
+	 *
+	 * Returns false if the code file cannot be loaded.
+	 */
+	bool addTable(const std::string& name, const char* huffmanCodeFilePath);
+
+	/**
+	 * Bind socketPath, replacing a stale socket file, and start numWorkers worker threads.
+	 * Workers accept connections and answer whichever connection has a request.
+	 *
+	 * Returns false if the socket cannot be created.
+	 */
+	bool start(const char* socketPath, int numWorkers);
+
+	/**
+	 * Stop accepting connections, wait for the workers, close all connections and remove
+	 * the socket file. Requests being answered are finished first.
+	 */
+	void stop();
+
+	/**
+	 * Number of requests answered so far.
+	 */
+	long long requestCount() const;
+
+private:
+	HuffmanServer(const HuffmanServer&);
+	HuffmanServer& operator=(const HuffmanServer&);
+
+	struct Connection;
+
+	void workerLoop();
+	void acceptConnections();
+	void serveConnection(uint64_t id, std::vector<uint8_t>& response);
+	bool answerRequest(Connection& connection, std::vector<uint8_t>& response);
+	void closeExpiredConnections();
+	void closeConnection(uint64_t id);
+
+	std::map<std::string, std::unique_ptr<HuffmanCodeTable> > tables;
+	std::vector<std::thread> workers;
+	std::string socketPath;
+	int listenSocket;
+	int epollFd;
+	std::atomic<bool> stopping;
+	std::atomic<long long> requests;
+
+	// Connections by id. The epoll events carry the id, so an event for a connection
+	// that was closed in the meantime is recognized and dropped.
+	std::mutex connectionsMutex;
+	std::map<uint64_t, std::unique_ptr<Connection> > connections;
+	uint64_t nextConnectionId;
+	long long nextExpiryCheck;
+};
+
+class HuffmanClient{
+
+public:
+	HuffmanClient();
+
+	/**
+	 * Closes the connection.
+	 */
+	~HuffmanClient();
+
+	/**
+	 * Connect to a HuffmanServer. Returns false if the server cannot be reached.
+	 */
+	bool connect(const char* socketPath);
+
+	/**
+	 * Send one request and wait for its response.
+	 *
+	 * @param operation One of HuffmanServer::Operation.
+	 * @param tableName Name of the code table, ignored for OP_LIST.
+	 * @param payload Request payload.
+	 * @param length Number of bytes in payload.
+	 * @param out Receives the response payload.
+	 *
+	 * Returns the response status, or -1 if the connection failed.
+	 */
+	int request(char operation, const std::string& tableName, const uint8_t* payload, size_t length, std::vector<uint8_t>& out);
+
+private:
+	HuffmanClient(const HuffmanClient&);
+	HuffmanClient& operator=(const HuffmanClient&);
+
+	int socket;
+};
+
+#endif /* HUFFMANSERVER_H_ */
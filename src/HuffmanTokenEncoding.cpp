@@ -0,0 +1,509 @@
+/*
+ * HuffmanTokenEncoding.cpp
+ *
+ * Word level Huffman mode. The input is split into maximal runs of letters and
+ * digits (words) and maximal runs of everything else (separators). Tokens seen
+ * at least twice in the training file form the vocabulary, together with all
+ * 256 single bytes so that unknown tokens can be spelled out byte by byte.
+ */
+
+#include "HuffmanEncoding.h"
+#include "HuffmanInternal.h"
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define TOKEN_TABLE_HEADER "#TOKENS"
+#define TOKEN_STREAM_HEADER "#HUFFTOKENS\n"
+
+namespace
+{
+
+// Longer runs are split so that vocabulary entries and code file lines stay short.
+const size_t MAX_TOKEN_LENGTH = 64;
+const int NUM_BYTES = 256;
+
+bool isWordByte(uint8_t byte)
+{
+    return isalnum(byte) != 0;
+}
+
+/**
+ * Length of the token starting at data[position].
+ */
+size_t tokenLength(const uint8_t *data, size_t size, size_t position)
+{
+    bool word = isWordByte(data[position]);
+    size_t end = position + 1;
+    while (end < size && end - position < MAX_TOKEN_LENGTH && isWordByte(data[end]) == word)
+        ++end;
+    return end - position;
+}
+
+struct TokenNode
+{
+    long long count;
+    int left;
+    int right;
+    int token;
+};
+
+/**
+ * Build the Huffman tree over counts with the two queue method: leaves sorted by count
+ * form the first queue and merged nodes, which are created in non-decreasing order of
+ * count, form the second. Returns the code of every token.
+ */
+std::vector<std::string> buildTokenCodes(const std::vector<long long> &counts)
+{
+    std::vector<TokenNode> nodes;
+    nodes.reserve(counts.size() * 2);
+    for (size_t t = 0; t < counts.size(); ++t)
+    {
+        TokenNode leaf = {counts[t], -1, -1, (int)t};
+        nodes.push_back(leaf);
+    }
+    std::vector<int> leaves(counts.size());
+    for (size_t t = 0; t < leaves.size(); ++t)
+        leaves[t] = (int)t;
+    std::stable_sort(leaves.begin(), leaves.end(), [&](int a, int b) { return counts[a] < counts[b]; });
+
+    size_t nextLeaf = 0, nextMerged = counts.size();
+    auto takeSmallest = [&]() {
+        if (nextLeaf < leaves.size() && (nextMerged == nodes.size() || nodes[leaves[nextLeaf]].count <= nodes[nextMerged].count))
+            return leaves[nextLeaf++];
+        return (int)nextMerged++;
+    };
+    for (size_t merges = 1; merges < counts.size(); ++merges)
+    {
+        int left = takeSmallest();
+        int right = takeSmallest();
+        TokenNode parent = {nodes[left].count + nodes[right].count, left, right, -1};
+        nodes.push_back(parent);
+    }
+
+    std::vector<std::string> codes(counts.size());
+    if (counts.empty())
+        return codes;
+
+    // Iterative traversal; a degenerate tree can be deeper than the stack allows.
+    std::vector<std::pair<int, std::string> > stack;
+    stack.push_back(std::make_pair((int)nodes.size() - 1, std::string()));
+    while (!stack.empty())
+    {
+        int index = stack.back().first;
+        std::string code;
+        code.swap(stack.back().second);
+        stack.pop_back();
+        const TokenNode &node = nodes[index];
+        if (node.token >= 0)
+        {
+            codes[node.token] = code.empty() ? "0" : code;
+            continue;
+        }
+        stack.push_back(std::make_pair(node.right, code + "1"));
+        stack.push_back(std::make_pair(node.left, code + "0"));
+    }
+    return codes;
+}
+
+/**
+ * Write token in a form that contains no quote, backslash or control character.
+ */
+void appendEscapedToken(const std::string &token, std::string &out)
+{
+    for (size_t i = 0; i < token.size(); ++i)
+    {
+        uint8_t byte = token[i];
+        if (byte == '\\')
+            out += "\\\\";
+        else if (byte == '\n')
+            out += "\\n";
+        else if (byte == '\r')
+            out += "\\r";
+        else if (byte == '\t')
+            out += "\\t";
+        else if (byte == '"' || byte < 0x20 || byte >= 0x7f)
+        {
+            char hex[8];
+            snprintf(hex, sizeof(hex), "\\x%02x", byte);
+            out += hex;
+        }
+        else
+            out += (char)byte;
+    }
+}
+
+int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Reverse appendEscapedToken. Returns false on a malformed escape.
+ */
+bool unescapeToken(const char *text, std::string &token)
+{
+    token.clear();
+    for (const char *p = text; *p; ++p)
+    {
+        if (*p != '\\')
+        {
+            token += *p;
+            continue;
+        }
+        ++p;
+        if (*p == '\\')
+            token += '\\';
+        else if (*p == 'n')
+            token += '\n';
+        else if (*p == 'r')
+            token += '\r';
+        else if (*p == 't')
+            token += '\t';
+        else if (*p == 'x' && hexDigit(p[1]) >= 0 && hexDigit(p[2]) >= 0)
+        {
+            token += (char)(hexDigit(p[1]) * 16 + hexDigit(p[2]));
+            p += 2;
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Vocabulary and codes read from a token code file. Single byte tokens are looked up
+ * through byteToken, longer ones through the hash map.
+ */
+class TokenTable
+{
+public:
+    bool load(const char *filePath);
+
+    /**
+     * Append the codes of data to out. Tokens outside the vocabulary are spelled out
+     * with single byte tokens. Returns false if a byte has no code.
+     */
+    bool encode(const uint8_t *data, size_t size, std::vector<uint8_t> &out) const;
+
+    /**
+     * Decode the bits in data, skipping line breaks. Returns false on an invalid code
+     * or a code cut off at the end of the stream.
+     */
+    bool decode(const uint8_t *data, size_t size, std::vector<uint8_t> &out) const;
+
+private:
+    bool addEntry(const std::string &token, const std::string &code);
+
+    std::vector<std::string> tokens;
+    std::vector<std::string> codes;
+    std::unordered_map<std::string, int> tokenIds;
+    int byteToken[NUM_BYTES];
+    // Decode trie. trie[node][bit] is the child node, a leaf encoded as -(token + 1),
+    // or 0 when the code does not exist; the root is never a child.
+    std::vector<int> trie;
+};
+
+bool TokenTable::addEntry(const std::string &token, const std::string &code)
+{
+    if (token.empty() || code.empty() || tokenIds.count(token))
+        return false;
+    int id = tokens.size();
+    tokens.push_back(token);
+    codes.push_back(code);
+    tokenIds[token] = id;
+    if (token.size() == 1)
+        byteToken[(uint8_t)token[0]] = id;
+
+    int node = 0;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (code[i] != '0' && code[i] != '1')
+            return false;
+        int &child = trie[node * 2 + (code[i] - '0')];
+        if (i + 1 == code.size())
+        {
+            if (child != 0)
+                return false;
+            child = -(id + 1);
+            return true;
+        }
+        if (child < 0)
+            return false;
+        if (child == 0)
+        {
+            child = trie.size() / 2;
+            trie.resize(trie.size() + 2, 0);
+        }
+        node = trie[node * 2 + (code[i] - '0')];
+    }
+    return true;
+}
+
+bool TokenTable::load(const char *filePath)
+{
+    std::vector<uint8_t> text;
+    if (!readWholeFile(filePath, text))
+        return false;
+    text.push_back('\0');
+
+    for (int b = 0; b < NUM_BYTES; ++b)
+        byteToken[b] = -1;
+    trie.assign(2, 0);
+
+    const char *line = (const char *)text.data();
+    if (strncmp(line, TOKEN_TABLE_HEADER, strlen(TOKEN_TABLE_HEADER)) != 0)
+        return false;
+
+    std::vector<char> lineBuffer, escaped, prob, code;
+    std::string token;
+    const char *end = line + text.size() - 1;
+    while (line < end)
+    {
+        const char *lineEnd = (const char *)memchr(line, '\n', end - line);
+        if (!lineEnd)
+            lineEnd = end;
+        if (*line != '#' && lineEnd > line)
+        {
+            size_t length = lineEnd - line;
+            lineBuffer.assign(line, lineEnd);
+            lineBuffer.push_back('\0');
+            escaped.assign(length + 1, '\0');
+            prob.assign(length + 1, '\0');
+            code.assign(length + 1, '\0');
+            parseLine(lineBuffer.data(), escaped.data(), prob.data(), code.data());
+            if (!unescapeToken(escaped.data(), token) || !addEntry(token, code.data()))
+                return false;
+        }
+        line = lineEnd + 1;
+    }
+    return true;
+}
+
+bool TokenTable::encode(const uint8_t *data, size_t size, std::vector<uint8_t> &out) const
+{
+    // The key is reused so that lookups do not allocate once it has grown to the longest token.
+    std::string key;
+    key.reserve(MAX_TOKEN_LENGTH);
+    size_t position = 0;
+    while (position < size)
+    {
+        size_t length = tokenLength(data, size, position);
+        key.assign((const char *)data + position, length);
+        std::unordered_map<std::string, int>::const_iterator found = tokenIds.find(key);
+        if (found != tokenIds.end())
+        {
+            const std::string &tokenCode = codes[found->second];
+            out.insert(out.end(), tokenCode.begin(), tokenCode.end());
+        }
+        else
+        {
+            for (size_t i = position; i < position + length; ++i)
+            {
+                if (byteToken[data[i]] < 0)
+                    return false;
+                const std::string &byteCode = codes[byteToken[data[i]]];
+                out.insert(out.end(), byteCode.begin(), byteCode.end());
+            }
+        }
+        position += length;
+    }
+    return true;
+}
+
+bool TokenTable::decode(const uint8_t *data, size_t size, std::vector<uint8_t> &out) const
+{
+    int node = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        uint8_t bit = data[i];
+        if (bit == '\n' || bit == '\r')
+            continue;
+        if (bit != '0' && bit != '1')
+            return false;
+        int next = trie[node * 2 + (bit - '0')];
+        if (next == 0)
+            return false;
+        if (next < 0)
+        {
+            const std::string &token = tokens[-next - 1];
+            out.insert(out.end(), token.begin(), token.end());
+            node = 0;
+        }
+        else
+            node = next;
+    }
+    return node == 0;
+}
+
+}
+
+void HuffmanEncoding::generateTokenCode(char *trainFilePath, char *resultFilePath)
+{
+    std::vector<uint8_t> text;
+    if (!readWholeFile(trainFilePath, text))
+    {
+        std::cerr << "Error: Unable to open input file.\n";
+        return;
+    }
+
+    std::vector<std::string> tokens;
+    std::vector<long long> counts;
+    {
+        CodecPhase phase("histogram");
+        phase.bytes = text.size();
+        std::unordered_map<std::string, int> tokenIds;
+        std::string key;
+        key.reserve(MAX_TOKEN_LENGTH);
+        size_t position = 0;
+        while (position < text.size())
+        {
+            size_t length = tokenLength(text.data(), text.size(), position);
+            key.assign((const char *)text.data() + position, length);
+            std::unordered_map<std::string, int>::iterator found = tokenIds.find(key);
+            if (found == tokenIds.end())
+            {
+                tokenIds.insert(std::make_pair(key, (int)tokens.size()));
+                tokens.push_back(key);
+                counts.push_back(1);
+            }
+            else
+                counts[found->second]++;
+            position += length;
+        }
+    }
+
+    // Keep tokens seen at least twice. Rare tokens are spelled out with single byte
+    // tokens, so their bytes are counted there; every byte gets a count of at least one.
+    std::vector<std::string> vocabulary;
+    std::vector<long long> vocabularyCounts;
+    long long byteCounts[NUM_BYTES];
+    for (int b = 0; b < NUM_BYTES; ++b)
+        byteCounts[b] = 1;
+    for (size_t t = 0; t < tokens.size(); ++t)
+    {
+        if (tokens[t].size() == 1)
+            byteCounts[(uint8_t)tokens[t][0]] += counts[t];
+        else if (counts[t] >= 2)
+        {
+            vocabulary.push_back(tokens[t]);
+            vocabularyCounts.push_back(counts[t]);
+        }
+        else
+        {
+            for (size_t i = 0; i < tokens[t].size(); ++i)
+                byteCounts[(uint8_t)tokens[t][i]] += counts[t];
+        }
+    }
+    for (int b = 0; b < NUM_BYTES; ++b)
+    {
+        vocabulary.push_back(std::string(1, (char)b));
+        vocabularyCounts.push_back(byteCounts[b]);
+    }
+
+    CodecPhase phase("tree build");
+    phase.bytes = text.size();
+    std::vector<std::string> codes = buildTokenCodes(vocabularyCounts);
+
+    long long total = 0;
+    for (size_t t = 0; t < vocabularyCounts.size(); ++t)
+        total += vocabularyCounts[t];
+
+    FILE *outputFile = fopen(resultFilePath, "w");
+    if (!outputFile)
+    {
+        std::cerr << "Error: Unable to open output file.\n";
+        return;
+    }
+    fprintf(outputFile, TOKEN_TABLE_HEADER " %d\n", (int)vocabulary.size());
+    std::string line;
+    for (size_t t = 0; t < vocabulary.size(); ++t)
+    {
+        char probText[64];
+        snprintf(probText, sizeof(probText), "%f", (double)vocabularyCounts[t] / total);
+        line = "\"";
+        appendEscapedToken(vocabulary[t], line);
+        line += "\" \"";
+        line += probText;
+        line += "\" \"";
+        line += codes[t];
+        line += "\"\n";
+        fputs(line.c_str(), outputFile);
+    }
+    fclose(outputFile);
+}
+
+void HuffmanEncoding::encodeTokens(char *testASCIIFilePath, char *tokenCodeFilePath, char *resultFilePath)
+{
+    TokenTable table;
+    if (!table.load(tokenCodeFilePath))
+    {
+        std::cerr << "Error: Unable to open token code file.\n";
+        return;
+    }
+
+    std::vector<uint8_t> text, encoded;
+    if (!readWholeFile(testASCIIFilePath, text))
+    {
+        std::cerr << "Error: Unable to open input file.\n";
+        return;
+    }
+
+    {
+        CodecPhase phase("encode");
+        phase.bytes = text.size();
+        const char *header = TOKEN_STREAM_HEADER;
+        encoded.insert(encoded.end(), header, header + strlen(header));
+        if (!table.encode(text.data(), text.size(), encoded))
+        {
+            std::cerr << "Error: Token code file has no code for some input bytes.\n";
+            return;
+        }
+    }
+
+    if (!writeWholeFile(resultFilePath, encoded))
+        std::cerr << "Error: Unable to open output encoded file.\n";
+}
+
+void HuffmanEncoding::decodeTokens(char *testEncodedFilePath, char *tokenCodeFilePath, char *resultFilePath)
+{
+    TokenTable table;
+    if (!table.load(tokenCodeFilePath))
+    {
+        std::cerr << "Error: Unable to open token code file.\n";
+        return;
+    }
+
+    std::vector<uint8_t> encoded, decoded;
+    if (!readWholeFile(testEncodedFilePath, encoded))
+    {
+        std::cerr << "Error: Unable to open input encoded file.\n";
+        return;
+    }
+
+    size_t headerLength = strlen(TOKEN_STREAM_HEADER);
+    if (encoded.size() < headerLength || memcmp(encoded.data(), TOKEN_STREAM_HEADER, headerLength) != 0)
+    {
+        std::cerr << "Error: Input is not a token encoded file.\n";
+        return;
+    }
+
+    {
+        CodecPhase phase("decode");
+        phase.bytes = encoded.size();
+        if (!table.decode(encoded.data() + headerLength, encoded.size() - headerLength, decoded))
+            std::cerr << "Error: Truncated or corrupt encoded file.\n";
+    }
+
+    if (!writeWholeFile(resultFilePath, decoded))
+        std::cerr << "Error: Unable to open output decoded file.\n";
+}
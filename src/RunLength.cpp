@@ -0,0 +1,148 @@
+#include "RunLength.h"
+
+const uint8_t RunLengthEncoder::ESCAPE;
+const uint8_t RunLengthEncoder::FIRST_DIGIT;
+const int RunLengthEncoder::NUM_DIGITS;
+const int RunLengthEncoder::MIN_RUN;
+const long long RunLengthEncoder::MAX_RUN;
+const size_t RunLengthEncoder::SAMPLE_SIZE;
+
+bool RunLengthEncoder::isReserved(uint8_t byte)
+{
+    return byte == ESCAPE || (byte >= FIRST_DIGIT && byte < FIRST_DIGIT + NUM_DIGITS);
+}
+
+bool RunLengthEncoder::isWorthwhile(const uint8_t *sample, size_t length)
+{
+    size_t runBytes = 0;
+    size_t i = 0;
+    while (i < length)
+    {
+        size_t end = i + 1;
+        while (end < length && sample[end] == sample[i])
+            ++end;
+        if (end - i >= (size_t)MIN_RUN)
+            runBytes += end - i;
+        i = end;
+    }
+    // One byte in eight in long runs already saves more than the escapes cost.
+    return length > 0 && runBytes * 8 >= length;
+}
+
+namespace
+{
+
+void appendLiteral(uint8_t byte, std::vector<uint8_t> &out)
+{
+    if (RunLengthEncoder::isReserved(byte))
+    {
+        out.push_back(RunLengthEncoder::ESCAPE);
+        out.push_back(RunLengthEncoder::ESCAPE);
+    }
+    out.push_back(byte);
+}
+
+}
+
+void RunLengthEncoder::encode(const uint8_t *data, size_t length, std::vector<uint8_t> &out)
+{
+    size_t i = 0;
+    while (i < length)
+    {
+        size_t end = i + 1;
+        while (end < length && data[end] == data[i] && (long long)(end - i) < MAX_RUN)
+            ++end;
+        long long run = end - i;
+        if (run < MIN_RUN)
+        {
+            for (long long r = 0; r < run; ++r)
+                appendLiteral(data[i], out);
+        }
+        else
+        {
+            appendLiteral(data[i], out);
+            out.push_back(ESCAPE);
+            long long value = run - MIN_RUN;
+            int numDigits = 1;
+            while ((value >> (4 * numDigits)) > 0)
+                ++numDigits;
+            for (int d = numDigits - 1; d >= 0; --d)
+                out.push_back(FIRST_DIGIT + ((value >> (4 * d)) & 15));
+        }
+        i = end;
+    }
+}
+
+RunLengthDecoder::RunLengthDecoder() : state(NORMAL), runValue(0), last(-1), failed(false)
+{
+}
+
+bool RunLengthDecoder::endRun(std::vector<uint8_t> &out)
+{
+    state = NORMAL;
+    // The byte that starts the run has been written already.
+    if (last < 0)
+        return false;
+    out.insert(out.end(), runValue + RunLengthEncoder::MIN_RUN - 1, static_cast<uint8_t>(last));
+    return true;
+}
+
+bool RunLengthDecoder::decode(const uint8_t *data, size_t length, std::vector<uint8_t> &out)
+{
+    size_t i = 0;
+    while (i < length && !failed)
+    {
+        uint8_t byte = data[i];
+        bool isDigit = byte >= RunLengthEncoder::FIRST_DIGIT && byte < RunLengthEncoder::FIRST_DIGIT + RunLengthEncoder::NUM_DIGITS;
+        switch (state)
+        {
+        case NORMAL:
+            if (byte == RunLengthEncoder::ESCAPE)
+                state = AFTER_ESCAPE;
+            else
+            {
+                out.push_back(byte);
+                last = byte;
+            }
+            break;
+        case AFTER_ESCAPE:
+            if (byte == RunLengthEncoder::ESCAPE)
+                state = LITERAL;
+            else if (isDigit)
+            {
+                state = DIGITS;
+                runValue = byte - RunLengthEncoder::FIRST_DIGIT;
+            }
+            else
+                failed = true;
+            break;
+        case LITERAL:
+            out.push_back(byte);
+            last = byte;
+            state = NORMAL;
+            break;
+        case DIGITS:
+            if (isDigit)
+            {
+                runValue = runValue * RunLengthEncoder::NUM_DIGITS + (byte - RunLengthEncoder::FIRST_DIGIT);
+                // The encoder never writes a longer run, so only a corrupt stream asks for one.
+                if (runValue + RunLengthEncoder::MIN_RUN > RunLengthEncoder::MAX_RUN)
+                    failed = true;
+                break;
+            }
+            if (!endRun(out))
+                failed = true;
+            // The byte after the run is handled in the normal state.
+            continue;
+        }
+        ++i;
+    }
+    return !failed;
+}
+
+bool RunLengthDecoder::finish(std::vector<uint8_t> &out)
+{
+    if (!failed && state == DIGITS && !endRun(out))
+        failed = true;
+    return !failed && state == NORMAL;
+}
@@ -0,0 +1,84 @@
+/*
+ * RunLength.h
+ *
+ * Run-length transform applied before the entropy coder. A run of at least
+ * MIN_RUN copies of a byte becomes the byte, ESCAPE and the run length minus
+ * MIN_RUN in base 16, written with the digit symbols FIRST_DIGIT to
+ * FIRST_DIGIT + 15, most significant digit first. An input byte that is itself
+ * ESCAPE or a digit symbol is written as ESCAPE ESCAPE byte. All of these
+ * symbols are control characters, so they do not collide with text.
+ */
+
+#ifndef RUNLENGTH_H_
+#define RUNLENGTH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class RunLengthEncoder{
+
+public:
+	static const uint8_t ESCAPE = 0x01;
+	static const uint8_t FIRST_DIGIT = 0x10;
+	static const int NUM_DIGITS = 16;
+	static const int MIN_RUN = 8;
+	// Longer runs are split. The decoder rejects a longer run as malformed, which
+	// bounds the output a few bytes of a corrupt stream can ask for.
+	static const long long MAX_RUN = 1 << 20;
+	// Number of leading input bytes passed to isWorthwhile.
+	static const size_t SAMPLE_SIZE = 1 << 20;
+
+	/**
+	 * Returns true if byte is ESCAPE or a digit symbol.
+	 */
+	static bool isReserved(uint8_t byte);
+
+	/**
+	 * Quick scan of a sample of the input. Returns true if enough of it is in long runs
+	 * for the transform to pay off.
+	 */
+	static bool isWorthwhile(const uint8_t* sample, size_t length);
+
+	/**
+	 * Append the transform of data to out. Runs do not continue across calls, so data
+	 * can be encoded in independent chunks.
+	 */
+	static void encode(const uint8_t* data, size_t length, std::vector<uint8_t>& out);
+};
+
+class RunLengthDecoder{
+
+public:
+	RunLengthDecoder();
+
+	/**
+	 * Append the inverse transform of data to out. data may end anywhere; the state
+	 * is kept for the next call. Returns false on a malformed stream.
+	 */
+	bool decode(const uint8_t* data, size_t length, std::vector<uint8_t>& out);
+
+	/**
+	 * Complete a run cut off by the end of the stream. Returns false if the stream
+	 * ended inside an escape sequence or was malformed.
+	 */
+	bool finish(std::vector<uint8_t>& out);
+
+private:
+	enum State
+	{
+		NORMAL,
+		AFTER_ESCAPE,
+		LITERAL,
+		DIGITS
+	};
+
+	bool endRun(std::vector<uint8_t>& out);
+
+	State state;
+	long long runValue;
+	int last;
+	bool failed;
+};
+
+#endif /* RUNLENGTH_H_ */
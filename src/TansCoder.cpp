@@ -0,0 +1,265 @@
+#include "EntropyCoder.h"
+#include "HuffmanInternal.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TANS_DEFAULT_TABLE_LOG 11
+
+namespace
+{
+
+int floorLog2(unsigned int value)
+{
+    int log = 0;
+    while (value >>= 1)
+        ++log;
+    return log;
+}
+
+void appendBits(unsigned int value, int numBits, std::vector<uint8_t> &out)
+{
+    for (int b = numBits - 1; b >= 0; --b)
+        out.push_back('0' + ((value >> b) & 1));
+}
+
+/**
+ * Read numBits bits starting at data[position]. Returns false if the bits run out.
+ */
+bool readBits(const uint8_t *data, size_t length, size_t &position, int numBits, unsigned int &value)
+{
+    value = 0;
+    for (int b = 0; b < numBits; ++b, ++position)
+    {
+        if (position >= length || (data[position] != '0' && data[position] != '1'))
+            return false;
+        value = (value << 1) | (data[position] - '0');
+    }
+    return true;
+}
+
+}
+
+TansCoder::TansCoder() : tableLog(0)
+{
+    memset(normalized, 0, sizeof(normalized));
+}
+
+int TansCoder::build(const int count[], size_t blockLength, std::string &serialized)
+{
+    const int numCharacters = HuffmanCodeTable::NUM_CHARACTERS;
+    int distinct = 0;
+    for (int c = 0; c < numCharacters; ++c)
+        distinct += count[c] > 0;
+
+    // Small blocks do not need a large table, but every symbol needs at least one
+    // state and the normalization below needs some slack.
+    tableLog = TANS_DEFAULT_TABLE_LOG;
+    int blockLog = floorLog2(blockLength > 0 ? blockLength : 1) + 1;
+    if (blockLog < tableLog)
+        tableLog = blockLog;
+    if (tableLog < MIN_TABLE_LOG)
+        tableLog = MIN_TABLE_LOG;
+    while ((1 << tableLog) < 2 * distinct)
+        tableLog++;
+    const int tableSize = 1 << tableLog;
+
+    // Round down, then hand the remaining states to the largest fractional parts.
+    double remainder[numCharacters];
+    int total = 0;
+    for (int c = 0; c < numCharacters; ++c)
+    {
+        normalized[c] = 0;
+        remainder[c] = -1.0;
+        if (count[c] == 0)
+            continue;
+        double exact = static_cast<double>(count[c]) * tableSize / blockLength;
+        normalized[c] = exact < 1.0 ? 1 : static_cast<int>(exact);
+        remainder[c] = exact - normalized[c];
+        total += normalized[c];
+    }
+    while (total < tableSize)
+    {
+        int best = -1;
+        for (int c = 0; c < numCharacters; ++c)
+        {
+            if (count[c] > 0 && (best < 0 || remainder[c] > remainder[best]))
+                best = c;
+        }
+        normalized[best]++;
+        remainder[best] -= 1.0;
+        total++;
+    }
+    // Rare symbols rounded up to one state can push the total over; take the excess
+    // from the symbols with the most states, where one state matters least.
+    while (total > tableSize)
+    {
+        int best = -1;
+        for (int c = 0; c < numCharacters; ++c)
+        {
+            if (normalized[c] > 1 && (best < 0 || normalized[c] > normalized[best]))
+                best = c;
+        }
+        normalized[best]--;
+        total--;
+    }
+
+    int numEntries = 0;
+    for (int c = 0; c < numCharacters; ++c)
+    {
+        if (normalized[c] == 0)
+            continue;
+        serialized += formatCodeLine(static_cast<char>(c), static_cast<double>(count[c]) / blockLength, std::to_string(normalized[c]));
+        numEntries++;
+    }
+    buildTables();
+    return numEntries;
+}
+
+bool TansCoder::parse(const char *text, size_t length)
+{
+    memset(normalized, 0, sizeof(normalized));
+    char line[256];
+    size_t start = 0;
+    while (start < length)
+    {
+        const char *lineEnd = static_cast<const char *>(memchr(text + start, '\n', length - start));
+        size_t end = lineEnd ? lineEnd - text : length;
+        if (end - start >= sizeof(line))
+            return false;
+        memcpy(line, text + start, end - start);
+        line[end - start] = '\0';
+        start = end + 1;
+
+        char character[256], prob[256], states[256];
+        parseLine(line, character, prob, states);
+        int c = codeLineCharacter(character);
+        int numStates = atoi(states);
+        if (c < 0 || c >= HuffmanCodeTable::NUM_CHARACTERS || numStates <= 0 || numStates > (1 << MAX_TABLE_LOG))
+            return false;
+        normalized[c] = numStates;
+    }
+
+    int total = 0;
+    for (int c = 0; c < HuffmanCodeTable::NUM_CHARACTERS; ++c)
+        total += normalized[c];
+    tableLog = floorLog2(total);
+    return buildTables();
+}
+
+bool TansCoder::buildTables()
+{
+    const int tableSize = 1 << tableLog;
+    int total = 0;
+    for (int c = 0; c < HuffmanCodeTable::NUM_CHARACTERS; ++c)
+        total += normalized[c];
+    if (total != tableSize || tableLog < MIN_TABLE_LOG || tableLog > MAX_TABLE_LOG)
+        return false;
+
+    // Spread every symbol's states over the table with an odd step, which visits
+    // every slot once because the table size is a power of two.
+    std::vector<uint8_t> spread(tableSize);
+    const int step = (tableSize >> 1) + (tableSize >> 3) + 3;
+    int position = 0;
+    for (int c = 0; c < HuffmanCodeTable::NUM_CHARACTERS; ++c)
+    {
+        for (int i = 0; i < normalized[c]; ++i)
+        {
+            spread[position] = static_cast<uint8_t>(c);
+            position = (position + step) & (tableSize - 1);
+        }
+    }
+
+    int next[HuffmanCodeTable::NUM_CHARACTERS];
+    int start = 0;
+    for (int c = 0; c < HuffmanCodeTable::NUM_CHARACTERS; ++c)
+    {
+        symbolStart[c] = start;
+        start += normalized[c];
+        next[c] = normalized[c];
+        symbolMaxBits[c] = normalized[c] > 0 ? tableLog - floorLog2(normalized[c]) : 0;
+    }
+
+    encodeStates.resize(tableSize);
+    decodeTable.resize(tableSize);
+    for (int state = 0; state < tableSize; ++state)
+    {
+        int c = spread[state];
+        int subState = next[c]++;
+        encodeStates[symbolStart[c] + subState - normalized[c]] = static_cast<uint16_t>(tableSize + state);
+
+        int numBits = tableLog - floorLog2(subState);
+        decodeTable[state].symbol = static_cast<uint8_t>(c);
+        decodeTable[state].numBits = static_cast<uint8_t>(numBits);
+        decodeTable[state].nextStateBase = static_cast<uint16_t>((subState << numBits) - tableSize);
+    }
+    return true;
+}
+
+long long TansCoder::estimateBits(const int count[]) const
+{
+    double bits = tableLog;
+    for (int c = 0; c < HuffmanCodeTable::NUM_CHARACTERS; ++c)
+    {
+        if (count[c] == 0)
+            continue;
+        if (normalized[c] == 0)
+            return -1;
+        bits += count[c] * (tableLog - log2(static_cast<double>(normalized[c])));
+    }
+    return static_cast<long long>(ceil(bits));
+}
+
+bool TansCoder::encode(const uint8_t *data, size_t size, std::vector<uint8_t> &out) const
+{
+    if (size == 0)
+        return true;
+
+    // ANS is last in, first out: the block is encoded backwards and the bits are
+    // written in reverse so that the decoder reads them front to back.
+    const unsigned int tableSize = 1u << tableLog;
+    std::vector<uint32_t> chunks(size);
+    unsigned int state = tableSize;
+    for (size_t i = size; i-- > 0;)
+    {
+        int c = data[i];
+        if (c >= HuffmanCodeTable::NUM_CHARACTERS || normalized[c] == 0)
+            return false;
+        int numBits = symbolMaxBits[c];
+        if (state < (static_cast<unsigned int>(normalized[c]) << numBits))
+            numBits--;
+        chunks[i] = ((state & ((1u << numBits) - 1)) << 4) | numBits;
+        state = encodeStates[symbolStart[c] + (state >> numBits) - normalized[c]];
+    }
+
+    appendBits(state - tableSize, tableLog, out);
+    for (size_t i = 0; i < size; ++i)
+        appendBits(chunks[i] >> 4, chunks[i] & 15, out);
+    return true;
+}
+
+long TansCoder::decode(const uint8_t *data, size_t length, long numSymbols, std::vector<uint8_t> &out) const
+{
+    if (numSymbols == 0)
+        return 0;
+    if (decodeTable.empty())
+        return -1;
+
+    CodecPhase phase("decode");
+    size_t position = 0;
+    unsigned int state;
+    if (!readBits(data, length, position, tableLog, state))
+        return -1;
+    for (long i = 0; i < numSymbols; ++i)
+    {
+        const DecodeEntry &entry = decodeTable[state];
+        out.push_back(entry.symbol);
+        unsigned int bits;
+        if (!readBits(data, length, position, entry.numBits, bits))
+            return -1;
+        state = entry.nextStateBase + bits;
+    }
+    phase.bytes = numSymbols;
+    // The encoder starts from state zero, so any other final state means corrupt bits.
+    return state == 0 ? static_cast<long>(position) : -1;
+}
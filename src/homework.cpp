@@ -9,12 +9,33 @@ int main(int argc, char **argv)
 	LogManager::writePrintfToLog(LogManager::Level::Status, "main", "In main file.");
 	printf("Usage:\n\n");
 	printf("./homework testCodeGeneration trainFilePath\n\n");
-	printf("./homework testEncoding testASCIIFilePath huffmanCodeFilePath\n\n");
+	printf("./homework testCorpusCodeGeneration corpusDirectoryOrGlob huffmanCodeFilePath [numThreads]\n\n");
+	printf("./homework testDecodeTableGeneration huffmanCodeFilePath\n\n");
+	printf("./homework testEncoding testASCIIFilePath huffmanCodeFilePath [seekIndexInterval]\n\n");
 	printf("./homework testDecoding testEncodedFilePath huffmanCodeFilePath\n\n");
+	printf("./homework testParallelDecoding testEncodedFilePath huffmanCodeFilePath [numThreads]\n\n");
+	printf("./homework testDecodeRange testEncodedFilePath huffmanCodeFilePath offset length\n\n");
+	printf("./homework testEstimate testASCIIFilePath huffmanCodeFilePath\n\n");
+	printf("./homework testBlockEncoding testASCIIFilePath blockSize huffmanCodeFilePath [huffmanCodeFilePath ...]\n\n");
+	printf("./homework testCoderEncoding testASCIIFilePath blockSize huffman|tans|auto [huffmanCodeFilePath ...]\n\n");
+	printf("./homework testBlockDecoding testEncodedFilePath [huffmanCodeFilePath ...]\n\n");
+	printf("./homework testTokenCodeGeneration trainFilePath\n\n");
+	printf("./homework testTokenEncoding testASCIIFilePath tokenCodeFilePath\n\n");
+	printf("./homework testTokenDecoding testEncodedFilePath tokenCodeFilePath\n\n");
+	printf("./homework testServe socketPath numWorkers tableName=huffmanCodeFilePath [tableName=huffmanCodeFilePath ...]\n\n");
+	printf("./homework testClient socketPath E|D|L tableName inputFilePath [repeat]\n\n");
+
+	printf("Set HUFFMAN_PERF=1 to report hardware performance counters per codec phase.\n");
+	printf("Set HUFFMAN_IO_URING=0 to use buffered file I/O instead of io_uring.\n\n");
 
 	if (argc < 2)
 		return 0;
 
+	if (getenv("HUFFMAN_PERF") != NULL)
+		PerfCounters::enable();
+	if (getenv("HUFFMAN_IO_URING") != NULL && strcmp(getenv("HUFFMAN_IO_URING"), "0") == 0)
+		AsyncFileIO::setIoUringEnabled(false);
+
 	int peakMem1 = getPeakRSS();
 	int currMem1 = getCurrentRSS();
 	printf("peakRSS = %d, currMem=%d\n", peakMem1, currMem1);
@@ -39,6 +60,14 @@ int main(int argc, char **argv)
 
 		HuffmanEncoding::generateAlphabetCode(inputTrainFilePath, outputHuffmanCodePath);
 	}
+	else if (strncmp(argv[1], "testCorpusCodeGeneration", 24) == 0 && argc >= 4)
+	{
+		HuffmanEncoding::generateCorpusCode(argv[2], argv[3], argc >= 5 ? atoi(argv[4]) : 0);
+	}
+	else if (strncmp(argv[1], "testDecodeTableGeneration", 25) == 0 && argc >= 3)
+	{
+		HuffmanEncoding::generateDecodeTable(argv[2]);
+	}
 	else if (strncmp(argv[1], "testEncoding", 12) == 0)
 	{
 		char testASCIIFilePath[1024], huffmanCodeFilePath[1024], outFile[1024];
@@ -48,7 +77,7 @@ int main(int argc, char **argv)
 		huffmanCodeFilePath[sizeof(huffmanCodeFilePath) - 1] = '\0';
 		snprintf(outFile, sizeof(outFile), "%s.encode.txt", testASCIIFilePath);
 
-		HuffmanEncoding::encodeText(testASCIIFilePath, huffmanCodeFilePath, outFile);
+		HuffmanEncoding::encodeText(testASCIIFilePath, huffmanCodeFilePath, outFile, argc >= 5 ? atoi(argv[4]) : 0);
 	}
 	else if (strncmp(argv[1], "testDecoding", 12) == 0)
 	{
@@ -61,6 +90,148 @@ int main(int argc, char **argv)
 
 		HuffmanEncoding::decodeText(testEncodedFilePath, huffmanCodeFilePath, outFile);
 	}
+	else if (strncmp(argv[1], "testParallelDecoding", 20) == 0 && argc >= 4)
+	{
+		char outFile[1024];
+		snprintf(outFile, sizeof(outFile), "%s.ascii.txt", argv[2]);
+
+		HuffmanEncoding::decodeTextParallel(argv[2], argv[3], outFile, argc >= 5 ? atoi(argv[4]) : 0);
+	}
+	else if (strncmp(argv[1], "testDecodeRange", 15) == 0 && argc >= 6)
+	{
+		char outFile[1024];
+		snprintf(outFile, sizeof(outFile), "%s.range.txt", argv[2]);
+
+		HuffmanEncoding::decodeRange(argv[2], argv[3], atol(argv[4]), atol(argv[5]), outFile);
+	}
+	else if (strncmp(argv[1], "testEstimate", 12) == 0 && argc >= 4)
+	{
+		HuffmanEncoding::estimateEncoding(argv[2], argv[3], true);
+	}
+	else if (strncmp(argv[1], "testBlockEncoding", 17) == 0 && argc >= 5)
+	{
+		char outFile[1024];
+		snprintf(outFile, sizeof(outFile), "%s.encode.txt", argv[2]);
+
+		HuffmanEncoding::encodeTextMultiTable(argv[2], argv + 4, argc - 4, outFile, atoi(argv[3]));
+	}
+	else if (strncmp(argv[1], "testCoderEncoding", 17) == 0 && argc >= 5)
+	{
+		HuffmanEncoding::EntropyBackend backend;
+		if (strcmp(argv[4], "huffman") == 0)
+			backend = HuffmanEncoding::BACKEND_HUFFMAN;
+		else if (strcmp(argv[4], "tans") == 0)
+			backend = HuffmanEncoding::BACKEND_TANS;
+		else if (strcmp(argv[4], "auto") == 0)
+			backend = HuffmanEncoding::BACKEND_AUTO;
+		else
+		{
+			std::cerr << "Error: Unknown entropy coder " << argv[4] << ".\n";
+			return 1;
+		}
+		char outFile[1024];
+		snprintf(outFile, sizeof(outFile), "%s.encode.txt", argv[2]);
+
+		HuffmanEncoding::encodeTextMultiTable(argv[2], argv + 5, argc - 5, outFile, atoi(argv[3]), backend);
+	}
+	else if (strncmp(argv[1], "testBlockDecoding", 17) == 0 && argc >= 3)
+	{
+		char outFile[1024];
+		snprintf(outFile, sizeof(outFile), "%s.ascii.txt", argv[2]);
+
+		HuffmanEncoding::decodeTextMultiTable(argv[2], argv + 3, argc - 3, outFile);
+	}
+	else if (strncmp(argv[1], "testTokenCodeGeneration", 23) == 0 && argc >= 3)
+	{
+		char outFile[1024];
+		snprintf(outFile, sizeof(outFile), "%s.tokens.txt", argv[2]);
+
+		HuffmanEncoding::generateTokenCode(argv[2], outFile);
+	}
+	else if (strncmp(argv[1], "testTokenEncoding", 17) == 0 && argc >= 4)
+	{
+		char outFile[1024];
+		snprintf(outFile, sizeof(outFile), "%s.encode.txt", argv[2]);
+
+		HuffmanEncoding::encodeTokens(argv[2], argv[3], outFile);
+	}
+	else if (strncmp(argv[1], "testTokenDecoding", 17) == 0 && argc >= 4)
+	{
+		char outFile[1024];
+		snprintf(outFile, sizeof(outFile), "%s.ascii.txt", argv[2]);
+
+		HuffmanEncoding::decodeTokens(argv[2], argv[3], outFile);
+	}
+	else if (strncmp(argv[1], "testServe", 9) == 0 && argc >= 5)
+	{
+		HuffmanServer server;
+		for (int i = 4; i < argc; ++i)
+		{
+			const char *separator = strchr(argv[i], '=');
+			if (!separator || !server.addTable(std::string(argv[i], separator - argv[i]), separator + 1))
+			{
+				std::cerr << "Error: Unable to load table " << argv[i] << ".\n";
+				return 1;
+			}
+		}
+
+		// Block the stop signals before the workers start so that only sigwait sees them.
+		sigset_t stopSignals;
+		sigemptyset(&stopSignals);
+		sigaddset(&stopSignals, SIGINT);
+		sigaddset(&stopSignals, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+		if (!server.start(argv[2], atoi(argv[3])))
+		{
+			std::cerr << "Error: Unable to listen on " << argv[2] << ".\n";
+			return 1;
+		}
+		printf("Serving on %s, send SIGINT or SIGTERM to stop.\n", argv[2]);
+		fflush(stdout);
+		int signal;
+		sigwait(&stopSignals, &signal);
+		server.stop();
+		printf("Answered %lld requests.\n", server.requestCount());
+	}
+	else if (strncmp(argv[1], "testClient", 10) == 0 && argc >= 5)
+	{
+		std::vector<uint8_t> payload, response;
+		if (argc >= 6)
+		{
+			std::ifstream input(argv[5], std::ios::binary);
+			if (!input)
+			{
+				std::cerr << "Error: Unable to open input file.\n";
+				return 1;
+			}
+			payload.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+		}
+		HuffmanClient client;
+		if (!client.connect(argv[2]))
+		{
+			std::cerr << "Error: Unable to connect to " << argv[2] << ".\n";
+			return 1;
+		}
+
+		int repeat = argc >= 7 ? atoi(argv[6]) : 1;
+		int status = -1;
+		auto requestStart = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeat; ++r)
+			status = client.request(argv[3][0], argv[4], payload.data(), payload.size(), response);
+		auto requestStop = std::chrono::high_resolution_clock::now();
+		double perRequest = std::chrono::duration<double, std::micro>(requestStop - requestStart).count() / (repeat > 0 ? repeat : 1);
+		printf("status = %d, response bytes = %d, %.1f microseconds per request\n", status, (int)response.size(), perRequest);
+
+		if (status == HuffmanServer::STATUS_OK && argc >= 6)
+		{
+			char outFile[1024];
+			snprintf(outFile, sizeof(outFile), "%s.%s.txt", argv[5], argv[3][0] == 'E' ? "encode" : "ascii");
+			std::ofstream output(outFile, std::ios::binary);
+			output.write((const char *)response.data(), response.size());
+		}
+		else if (status == HuffmanServer::STATUS_OK)
+			fwrite(response.data(), 1, response.size(), stdout);
+	}
 
 	auto stop = std::chrono::high_resolution_clock::now();
 	auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
@@ -70,6 +241,11 @@ int main(int argc, char **argv)
 	int currMem2 = getCurrentRSS();
 	printf("peakRSS = %d, currMem=%d\n", peakMem2, currMem2);
 	printf("Diff peakRSS = %d, currMem=%d\n", peakMem2 - peakMem1, currMem2 - currMem1);
+	if (AllocTracker::isEnabled())
+		AllocTracker::printReport();
+
+	if (getenv("HUFFMAN_PERF") != NULL)
+		PerfCounters::printReport();
 
 	return 0;
 }
\ No newline at end of file
@@ -12,9 +12,14 @@
 #include <fstream>
 #include <limits.h>
 #include <chrono>
+#include <signal.h>
 
 #include "HuffmanEncoding.h"
+#include "HuffmanServer.h"
+#include "util/AllocTracker.h"
+#include "util/AsyncFileIO.h"
 #include "util/GetMemUsage.h"
 #include "util/LogManager.h"
+#include "util/PerfCounters.h"
 
 #endif /* BITVECTOR_SRC_HOMEWORK_H_ */
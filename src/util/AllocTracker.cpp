@@ -0,0 +1,253 @@
+/*
+ * AllocTracker.cpp
+ *
+ * Replacement operator new and operator delete that prefix every block with its
+ * size and phase, and per phase counters updated with atomics so that any thread
+ * may allocate or free. Phase names are interned on first use; later lookups of
+ * the same string literal only compare pointers.
+ */
+
+#include "AllocTracker.h"
+
+#include <stdio.h>
+
+#ifdef HUFFMAN_TRACK_ALLOCATIONS
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+
+namespace
+{
+
+const int MAX_PHASES = 32;
+const int MAX_ALIASES = 64;
+const int MAX_DEPTH = 16;
+
+// Every block carries its size and owning phase in front of the user pointer.
+// The header is 16 bytes so that the user pointer keeps malloc's alignment.
+struct AllocHeader
+{
+	size_t size;
+	int phase;
+	int padding;
+};
+const size_t HEADER_SIZE = 16;
+static_assert(sizeof(AllocHeader) <= HEADER_SIZE, "allocation header too large");
+
+struct PhaseCounters
+{
+	const char *name;
+	std::atomic<long long> allocations;
+	std::atomic<long long> frees;
+	std::atomic<long long> bytes;
+	std::atomic<long long> liveBytes;
+	std::atomic<long long> peakLiveBytes;
+};
+
+// Slot 0 collects allocations made outside of any phase. All of this state is
+// zero initialized before any constructor runs, so it is safe to use from
+// allocations made during static initialization.
+PhaseCounters phases[MAX_PHASES];
+std::atomic<int> numPhases(1);
+std::mutex registerMutex;
+
+// Name pointers already looked up, with their phase. Equal literals in different
+// translation units may have different addresses, so a phase can have several.
+// Entries are complete before numAliases is raised past them.
+struct PhaseAlias
+{
+	const char *name;
+	int phase;
+};
+PhaseAlias aliases[MAX_ALIASES];
+std::atomic<int> numAliases(0);
+
+thread_local int phaseStack[MAX_DEPTH];
+thread_local int phaseDepth = 0;
+
+int registerPhase(const char *phaseName)
+{
+	std::lock_guard<std::mutex> lock(registerMutex);
+	int phase = 0;
+	int count = numPhases.load();
+	for (int p = 1; p < count && phase == 0; ++p)
+	{
+		if (strcmp(phases[p].name, phaseName) == 0)
+			phase = p;
+	}
+	if (phase == 0 && count < MAX_PHASES)
+	{
+		phases[count].name = phaseName;
+		numPhases.store(count + 1);
+		phase = count;
+	}
+
+	int aliasCount = numAliases.load();
+	for (int a = 0; a < aliasCount; ++a)
+	{
+		if (aliases[a].name == phaseName)
+			return phase;
+	}
+	if (aliasCount < MAX_ALIASES)
+	{
+		aliases[aliasCount].name = phaseName;
+		aliases[aliasCount].phase = phase;
+		numAliases.store(aliasCount + 1, std::memory_order_release);
+	}
+	return phase;
+}
+
+int findPhase(const char *phaseName)
+{
+	int aliasCount = numAliases.load(std::memory_order_acquire);
+	for (int a = 0; a < aliasCount; ++a)
+	{
+		if (aliases[a].name == phaseName)
+			return aliases[a].phase;
+	}
+	return registerPhase(phaseName);
+}
+
+void *trackedAlloc(size_t size)
+{
+	AllocHeader *header = (AllocHeader *)malloc(size + HEADER_SIZE);
+	if (!header)
+		return NULL;
+
+	int phase = phaseDepth > 0 ? phaseStack[phaseDepth - 1] : 0;
+	header->size = size;
+	header->phase = phase;
+
+	PhaseCounters &counters = phases[phase];
+	counters.allocations++;
+	counters.bytes += size;
+	long long live = (counters.liveBytes += size);
+	long long peak = counters.peakLiveBytes.load();
+	while (live > peak && !counters.peakLiveBytes.compare_exchange_weak(peak, live))
+		;
+	return (char *)header + HEADER_SIZE;
+}
+
+void trackedFree(void *pointer)
+{
+	if (!pointer)
+		return;
+	AllocHeader *header = (AllocHeader *)((char *)pointer - HEADER_SIZE);
+	PhaseCounters &counters = phases[header->phase];
+	counters.frees++;
+	counters.liveBytes -= header->size;
+	free(header);
+}
+
+}
+
+void *operator new(size_t size)
+{
+	void *pointer = trackedAlloc(size);
+	if (!pointer)
+		throw std::bad_alloc();
+	return pointer;
+}
+
+void *operator new[](size_t size)
+{
+	void *pointer = trackedAlloc(size);
+	if (!pointer)
+		throw std::bad_alloc();
+	return pointer;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return trackedAlloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return trackedAlloc(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+	trackedFree(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+	trackedFree(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+	trackedFree(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+	trackedFree(pointer);
+}
+
+bool AllocTracker::isEnabled()
+{
+	return true;
+}
+
+void AllocTracker::beginPhase(const char *phaseName)
+{
+	int phase = findPhase(phaseName);
+	if (phaseDepth < MAX_DEPTH)
+		phaseStack[phaseDepth] = phase;
+	phaseDepth++;
+}
+
+void AllocTracker::endPhase()
+{
+	if (phaseDepth > 0)
+		phaseDepth--;
+}
+
+void AllocTracker::printReport()
+{
+	printf("%-12s %12s %12s %14s %14s %14s\n", "phase", "allocations", "frees", "bytes", "peakLiveBytes", "liveBytes");
+	long long totalAllocations = 0, totalFrees = 0, totalBytes = 0, totalLiveBytes = 0;
+	int count = numPhases.load();
+	for (int p = 0; p < count; ++p)
+	{
+		const PhaseCounters &counters = phases[p];
+		if (counters.allocations == 0)
+			continue;
+		printf("%-12s %12lld %12lld %14lld %14lld %14lld\n", p == 0 ? "(no phase)" : counters.name,
+			   counters.allocations.load(), counters.frees.load(), counters.bytes.load(),
+			   counters.peakLiveBytes.load(), counters.liveBytes.load());
+		totalAllocations += counters.allocations;
+		totalFrees += counters.frees;
+		totalBytes += counters.bytes;
+		totalLiveBytes += counters.liveBytes;
+	}
+	printf("%-12s %12lld %12lld %14lld %14s %14lld\n", "total", totalAllocations, totalFrees, totalBytes, "-", totalLiveBytes);
+}
+
+#else
+
+bool AllocTracker::isEnabled()
+{
+	return false;
+}
+
+void AllocTracker::beginPhase(const char *)
+{
+}
+
+void AllocTracker::endPhase()
+{
+}
+
+void AllocTracker::printReport()
+{
+	printf("allocation tracking: not compiled in (configure with -DHUFFMAN_TRACK_ALLOCATIONS=ON)\n");
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * AllocTracker.h
+ *
+ * Counts heap allocations, allocated bytes and peak live bytes per named
+ * phase by replacing the global operator new and operator delete. The hooks
+ * are only compiled in when HUFFMAN_TRACK_ALLOCATIONS is defined (CMake option
+ * of the same name); otherwise every function is a no-op.
+ */
+
+#ifndef UTIL_ALLOCTRACKER_H_
+#define UTIL_ALLOCTRACKER_H_
+
+class AllocTracker{
+
+public:
+	/**
+	 * Returns true if the operator new/delete hooks are compiled in.
+	 */
+	static bool isEnabled();
+
+	/**
+	 * Attribute allocations made by the calling thread to the named phase until the
+	 * matching endPhase call. Phases nest; allocations go to the innermost one.
+	 * \param[in] phaseName Name of the phase. Must outlive the process, e.g. a string literal.
+	 * Phases with equal names share their counters.
+	 */
+	static void beginPhase(const char* phaseName);
+
+	/**
+	 * End the innermost phase of the calling thread.
+	 */
+	static void endPhase();
+
+	/**
+	 * Print allocation count, allocated bytes, peak live bytes and bytes still live for
+	 * every phase. Memory allocated in a phase and still live at exit points to a leak.
+	 */
+	static void printReport();
+};
+
+#endif /* UTIL_ALLOCTRACKER_H_ */
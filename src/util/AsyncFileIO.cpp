@@ -0,0 +1,479 @@
+/*
+ * AsyncFileIO.cpp
+ *
+ */
+
+#include "AsyncFileIO.h"
+
+#include <string.h>
+#include <atomic>
+
+#if defined(HUFFMAN_USE_IO_URING)
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+std::atomic<bool> ioUringAllowed(true);
+
+}
+
+void AsyncFileIO::setIoUringEnabled(bool enabled)
+{
+	ioUringAllowed = enabled;
+}
+
+bool AsyncFileIO::isIoUringEnabled()
+{
+#if defined(HUFFMAN_USE_IO_URING)
+	return ioUringAllowed;
+#else
+	return false;
+#endif
+}
+
+#if defined(HUFFMAN_USE_IO_URING)
+
+/**
+ * Submission and completion rings shared with the kernel. Each ring is used by a
+ * single thread, so only the kernel side needs acquire/release ordering.
+ */
+struct IoUring
+{
+	int ringFd;
+	unsigned *sqTail;
+	unsigned sqMask;
+	unsigned *sqArray;
+	struct io_uring_sqe *sqes;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned cqMask;
+	struct io_uring_cqe *cqes;
+	void *sqRing;
+	size_t sqRingSize;
+	void *cqRing;
+	size_t cqRingSize;
+	size_t sqesSize;
+	bool fixedBuffers;
+};
+
+namespace
+{
+
+void destroyRing(IoUring *ring)
+{
+	if (!ring)
+		return;
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqesSize);
+	if (ring->cqRing && ring->cqRing != ring->sqRing)
+		munmap(ring->cqRing, ring->cqRingSize);
+	if (ring->sqRing)
+		munmap(ring->sqRing, ring->sqRingSize);
+	close(ring->ringFd);
+	delete ring;
+}
+
+void *mapRing(int ringFd, size_t size, off_t offset)
+{
+	void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, offset);
+	return memory == MAP_FAILED ? NULL : memory;
+}
+
+/**
+ * Returns true if the kernel supports IORING_OP_READ and IORING_OP_WRITE. Kernels
+ * without IORING_REGISTER_PROBE predate both opcodes.
+ */
+bool supportsReadWrite(int ringFd)
+{
+	const unsigned numOps = 256;
+	std::vector<uint8_t> memory(sizeof(struct io_uring_probe) + numOps * sizeof(struct io_uring_probe_op), 0);
+	struct io_uring_probe *probe = (struct io_uring_probe *)memory.data();
+	if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, numOps) != 0)
+		return false;
+	const int required[] = {IORING_OP_READ, IORING_OP_WRITE};
+	for (size_t r = 0; r < sizeof(required) / sizeof(required[0]); ++r)
+	{
+		if (required[r] > probe->last_op || !(probe->ops[required[r]].flags & IO_URING_OP_SUPPORTED))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Returns true if file is a regular file with a known position. Requests in the ring
+ * carry explicit offsets, which pipes and FIFOs do not have.
+ */
+bool supportsOffsets(FILE *file)
+{
+	struct stat status;
+	return fstat(fileno(file), &status) == 0 && S_ISREG(status.st_mode) && ftello(file) >= 0;
+}
+
+/**
+ * Set up a ring for one request per buffer and register the buffers with it. Returns
+ * NULL if io_uring is unavailable. If the buffers cannot be registered, for example
+ * because of RLIMIT_MEMLOCK, the ring still works with unregistered reads and writes
+ * where the kernel has them.
+ */
+IoUring *createRing(std::vector<std::vector<uint8_t> > &buffers)
+{
+	if (!ioUringAllowed)
+		return NULL;
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int ringFd = (int)syscall(__NR_io_uring_setup, (unsigned)buffers.size(), &params);
+	if (ringFd < 0)
+		return NULL;
+
+	IoUring *ring = new IoUring();
+	ring->ringFd = ringFd;
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (singleMap && ring->cqRingSize > ring->sqRingSize)
+		ring->sqRingSize = ring->cqRingSize;
+
+	ring->sqRing = mapRing(ringFd, ring->sqRingSize, IORING_OFF_SQ_RING);
+	ring->cqRing = singleMap ? ring->sqRing : mapRing(ringFd, ring->cqRingSize, IORING_OFF_CQ_RING);
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe *)mapRing(ringFd, ring->sqesSize, IORING_OFF_SQES);
+	if (!ring->sqRing || !ring->cqRing || !ring->sqes)
+	{
+		destroyRing(ring);
+		return NULL;
+	}
+
+	char *sq = (char *)ring->sqRing;
+	char *cq = (char *)ring->cqRing;
+	ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+	ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+	ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	std::vector<struct iovec> iovecs(buffers.size());
+	for (size_t b = 0; b < buffers.size(); ++b)
+	{
+		iovecs[b].iov_base = buffers[b].data();
+		iovecs[b].iov_len = buffers[b].size();
+	}
+	ring->fixedBuffers = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, iovecs.data(), (unsigned)iovecs.size()) == 0;
+
+	// READ_FIXED and WRITE_FIXED exist since io_uring itself. Unregistered buffers need
+	// IORING_OP_READ and IORING_OP_WRITE, which kernels before 5.6 lack.
+	if (!ring->fixedBuffers && !supportsReadWrite(ringFd))
+	{
+		destroyRing(ring);
+		return NULL;
+	}
+	return ring;
+}
+
+bool submitRequest(IoUring *ring, bool isWrite, int fd, int slot, void *buffer, size_t length, long long offset)
+{
+	unsigned tail = *ring->sqTail;
+	unsigned index = tail & ring->sqMask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	if (ring->fixedBuffers)
+	{
+		sqe->opcode = isWrite ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+		sqe->buf_index = slot;
+	}
+	else
+	{
+		sqe->opcode = isWrite ? IORING_OP_WRITE : IORING_OP_READ;
+	}
+	sqe->fd = fd;
+	sqe->addr = (unsigned long long)buffer;
+	sqe->len = (unsigned)length;
+	sqe->off = offset;
+	sqe->user_data = slot;
+	ring->sqArray[index] = index;
+	__atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+	long submitted;
+	do
+	{
+		submitted = syscall(__NR_io_uring_enter, ring->ringFd, 1, 0, 0, NULL, 0);
+	} while (submitted < 0 && errno == EINTR);
+	return submitted == 1;
+}
+
+bool waitCompletion(IoUring *ring, int &slot, int &result)
+{
+	while (true)
+	{
+		unsigned head = *ring->cqHead;
+		if (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+		{
+			struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+			slot = (int)cqe->user_data;
+			result = cqe->res;
+			__atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+			return true;
+		}
+		if (syscall(__NR_io_uring_enter, ring->ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+			return false;
+	}
+}
+
+}
+
+#endif
+
+AsyncFileReader::AsyncFileReader(FILE *file, size_t chunkSize, int depth)
+	: file(file), chunkSize(chunkSize), depth(depth), ring(NULL), nextOffset(0), nextSlot(0), inFlight(0), endOfFile(false)
+{
+#if defined(HUFFMAN_USE_IO_URING)
+	if (!supportsOffsets(file))
+		return;
+	buffers.assign(depth, std::vector<uint8_t>(chunkSize));
+	ring = createRing(buffers);
+	if (!ring)
+	{
+		buffers.clear();
+		return;
+	}
+	slotOffsets.assign(depth, 0);
+	results.assign(depth, 0);
+	completed.assign(depth, false);
+	nextOffset = ftello(file);
+	for (int slot = 0; slot < depth; ++slot)
+		submit(slot);
+#endif
+}
+
+AsyncFileReader::~AsyncFileReader()
+{
+#if defined(HUFFMAN_USE_IO_URING)
+	// The kernel may still be writing into the buffers.
+	while (inFlight > 0 && reap())
+		;
+	destroyRing(ring);
+#endif
+}
+
+bool AsyncFileReader::isAsync() const
+{
+	return ring != NULL;
+}
+
+bool AsyncFileReader::submit(int slot)
+{
+#if defined(HUFFMAN_USE_IO_URING)
+	slotOffsets[slot] = nextOffset;
+	nextOffset += chunkSize;
+	completed[slot] = false;
+	if (!submitRequest(ring, false, fileno(file), slot, buffers[slot].data(), chunkSize, slotOffsets[slot]))
+	{
+		results[slot] = -1;
+		completed[slot] = true;
+		return false;
+	}
+	inFlight++;
+	return true;
+#else
+	(void)slot;
+	return false;
+#endif
+}
+
+bool AsyncFileReader::reap()
+{
+#if defined(HUFFMAN_USE_IO_URING)
+	int slot, result;
+	if (!waitCompletion(ring, slot, result))
+		return false;
+	inFlight--;
+	results[slot] = result;
+	completed[slot] = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+long AsyncFileReader::read(uint8_t *buffer)
+{
+	if (!ring)
+	{
+		size_t length = fread(buffer, 1, chunkSize, file);
+		if (length == 0 && ferror(file))
+			return -1;
+		return (long)length;
+	}
+
+#if defined(HUFFMAN_USE_IO_URING)
+	if (endOfFile)
+		return 0;
+
+	int slot = nextSlot;
+	while (!completed[slot])
+	{
+		if (!reap())
+			return -1;
+	}
+	long length = results[slot];
+	if (length < 0)
+		return -1;
+
+	// A short read before the end of the file would leave a gap that the chunks
+	// already in flight do not cover, so the rest of the chunk is read here.
+	while (length < (long)chunkSize)
+	{
+		ssize_t more = pread(fileno(file), buffers[slot].data() + length, chunkSize - length, slotOffsets[slot] + length);
+		if (more < 0 && errno == EINTR)
+			continue;
+		if (more < 0)
+			return -1;
+		if (more == 0)
+			break;
+		length += more;
+	}
+
+	memcpy(buffer, buffers[slot].data(), length);
+	if (length < (long)chunkSize)
+		endOfFile = true;
+	else
+		submit(slot);
+	nextSlot = (slot + 1) % depth;
+	return length;
+#else
+	return -1;
+#endif
+}
+
+AsyncFileWriter::AsyncFileWriter(FILE *file, size_t chunkSize, int depth)
+	: file(file), chunkSize(chunkSize), depth(depth), ring(NULL), nextOffset(0), inFlight(0), failed(false)
+{
+#if defined(HUFFMAN_USE_IO_URING)
+	// Flushed first, so the position includes anything written through the stream.
+	fflush(file);
+	if (!supportsOffsets(file))
+		return;
+	buffers.assign(depth, std::vector<uint8_t>(chunkSize));
+	ring = createRing(buffers);
+	if (!ring)
+	{
+		buffers.clear();
+		return;
+	}
+	slotOffsets.assign(depth, 0);
+	slotLengths.assign(depth, 0);
+	for (int slot = depth - 1; slot >= 0; --slot)
+		freeSlots.push_back(slot);
+	nextOffset = ftello(file);
+#endif
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+	finish();
+#if defined(HUFFMAN_USE_IO_URING)
+	destroyRing(ring);
+#endif
+}
+
+bool AsyncFileWriter::isAsync() const
+{
+	return ring != NULL;
+}
+
+bool AsyncFileWriter::write(const uint8_t *data, size_t length)
+{
+	if (!ring)
+	{
+		if (fwrite(data, 1, length, file) != length)
+			failed = true;
+		return !failed;
+	}
+
+#if defined(HUFFMAN_USE_IO_URING)
+	while (length > 0 && !failed)
+	{
+		while (freeSlots.empty() && !failed)
+		{
+			if (!reap())
+				failed = true;
+		}
+		if (failed)
+			break;
+
+		int slot = freeSlots.back();
+		freeSlots.pop_back();
+		size_t piece = length < chunkSize ? length : chunkSize;
+		memcpy(buffers[slot].data(), data, piece);
+		slotOffsets[slot] = nextOffset;
+		slotLengths[slot] = piece;
+		nextOffset += piece;
+		data += piece;
+		length -= piece;
+
+		if (submitRequest(ring, true, fileno(file), slot, buffers[slot].data(), piece, slotOffsets[slot]))
+			inFlight++;
+		else
+			failed = true;
+	}
+#endif
+	return !failed;
+}
+
+bool AsyncFileWriter::reap()
+{
+#if defined(HUFFMAN_USE_IO_URING)
+	int slot, result;
+	if (!waitCompletion(ring, slot, result))
+		return false;
+	inFlight--;
+
+	if (result < 0)
+		failed = true;
+	// Complete a short write synchronously.
+	size_t written = result < 0 ? 0 : result;
+	while (!failed && written < slotLengths[slot])
+	{
+		ssize_t more = pwrite(fileno(file), buffers[slot].data() + written, slotLengths[slot] - written, slotOffsets[slot] + written);
+		if (more < 0 && errno == EINTR)
+			continue;
+		if (more <= 0)
+			failed = true;
+		else
+			written += more;
+	}
+	freeSlots.push_back(slot);
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool AsyncFileWriter::finish()
+{
+	if (!ring)
+		return fflush(file) == 0 && !failed;
+
+#if defined(HUFFMAN_USE_IO_URING)
+	while (inFlight > 0)
+	{
+		if (!reap())
+		{
+			failed = true;
+			break;
+		}
+	}
+	fseeko(file, nextOffset, SEEK_SET);
+#endif
+	return !failed;
+}
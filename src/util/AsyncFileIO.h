@@ -0,0 +1,127 @@
+/*
+ * AsyncFileIO.h
+ *
+ * Sequential chunked file reader and writer that keep several requests in
+ * flight through io_uring on Linux, with registered buffers when the kernel
+ * allows it. When io_uring is not compiled in (HUFFMAN_USE_IO_URING) or the
+ * ring cannot be set up at runtime, both classes fall back to fread/fwrite.
+ */
+
+#ifndef UTIL_ASYNCFILEIO_H_
+#define UTIL_ASYNCFILEIO_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+struct IoUring;
+
+class AsyncFileIO{
+
+public:
+	/**
+	 * Allow or forbid io_uring for readers and writers created afterwards.
+	 * It is allowed by default.
+	 */
+	static void setIoUringEnabled(bool enabled);
+
+	/**
+	 * Returns true if io_uring is compiled in and allowed.
+	 */
+	static bool isIoUringEnabled();
+};
+
+class AsyncFileReader{
+
+public:
+	/**
+	 * Read file from its current position in chunks of chunkSize bytes, keeping up to
+	 * depth reads in flight.
+	 */
+	AsyncFileReader(FILE* file, size_t chunkSize, int depth);
+	~AsyncFileReader();
+
+	/**
+	 * Copy the next chunk into buffer, which must hold chunkSize bytes. Every chunk
+	 * except the last one is full. Returns the number of bytes copied, 0 at the end of
+	 * the file and -1 on a read error.
+	 */
+	long read(uint8_t* buffer);
+
+	/**
+	 * Returns true if reads go through io_uring.
+	 */
+	bool isAsync() const;
+
+private:
+	AsyncFileReader(const AsyncFileReader&);
+	AsyncFileReader& operator=(const AsyncFileReader&);
+
+	bool submit(int slot);
+	bool reap();
+
+	FILE* file;
+	size_t chunkSize;
+	int depth;
+	IoUring* ring;
+	std::vector<std::vector<uint8_t> > buffers;
+	std::vector<long long> slotOffsets;
+	std::vector<long> results;
+	std::vector<bool> completed;
+	long long nextOffset;
+	int nextSlot;
+	int inFlight;
+	bool endOfFile;
+};
+
+class AsyncFileWriter{
+
+public:
+	/**
+	 * Write to file from its current position, keeping up to depth writes of at most
+	 * chunkSize bytes in flight.
+	 */
+	AsyncFileWriter(FILE* file, size_t chunkSize, int depth);
+
+	/**
+	 * Calls finish().
+	 */
+	~AsyncFileWriter();
+
+	/**
+	 * Queue length bytes for writing. The data is copied before returning.
+	 * Returns false if a previous write failed.
+	 */
+	bool write(const uint8_t* data, size_t length);
+
+	/**
+	 * Wait for all queued writes and leave the file positioned after the written data.
+	 * Returns false if any write failed.
+	 */
+	bool finish();
+
+	/**
+	 * Returns true if writes go through io_uring.
+	 */
+	bool isAsync() const;
+
+private:
+	AsyncFileWriter(const AsyncFileWriter&);
+	AsyncFileWriter& operator=(const AsyncFileWriter&);
+
+	bool reap();
+
+	FILE* file;
+	size_t chunkSize;
+	int depth;
+	IoUring* ring;
+	std::vector<std::vector<uint8_t> > buffers;
+	std::vector<long long> slotOffsets;
+	std::vector<size_t> slotLengths;
+	std::vector<int> freeSlots;
+	long long nextOffset;
+	int inFlight;
+	bool failed;
+};
+
+#endif /* UTIL_ASYNCFILEIO_H_ */
@@ -0,0 +1,90 @@
+/*
+ * MappedFile.cpp
+ *
+ */
+
+#include "MappedFile.h"
+
+#include <stdio.h>
+
+#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_USE_MMAP
+#endif
+
+MappedFile::MappedFile() : mapping(NULL), length(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char *filePath)
+{
+	close();
+#ifdef MAPPED_FILE_USE_MMAP
+	int fd = ::open(filePath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat status;
+	if (fstat(fd, &status) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+	length = status.st_size;
+	if (length > 0)
+	{
+		void *address = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (address != MAP_FAILED)
+		{
+			mapping = address;
+			// Decoders read front to back.
+			madvise(mapping, length, MADV_SEQUENTIAL);
+		}
+	}
+	::close(fd);
+	if (mapping || length == 0)
+		return true;
+#endif
+
+	// No mmap: read the file into the heap.
+	FILE *file = fopen(filePath, "rb");
+	if (!file)
+		return false;
+	buffer.clear();
+	uint8_t chunk[1 << 16];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		buffer.insert(buffer.end(), chunk, chunk + n);
+	bool ok = !ferror(file);
+	fclose(file);
+	length = buffer.size();
+	return ok;
+}
+
+void MappedFile::close()
+{
+#ifdef MAPPED_FILE_USE_MMAP
+	if (mapping)
+		munmap(mapping, length);
+#endif
+	mapping = NULL;
+	length = 0;
+	buffer.clear();
+}
+
+const uint8_t *MappedFile::data() const
+{
+	return mapping ? static_cast<const uint8_t *>(mapping) : buffer.data();
+}
+
+size_t MappedFile::size() const
+{
+	return length;
+}
@@ -0,0 +1,48 @@
+/*
+ * MappedFile.h
+ *
+ * Read-only view of a whole file. The file is memory mapped where the platform
+ * allows it, so large files are paged in on demand instead of being copied into
+ * the heap; otherwise it is read into a buffer.
+ */
+
+#ifndef UTIL_MAPPEDFILE_H_
+#define UTIL_MAPPEDFILE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class MappedFile{
+
+public:
+	MappedFile();
+
+	/**
+	 * Calls close().
+	 */
+	~MappedFile();
+
+	/**
+	 * Map filePath. Returns false if the file cannot be opened or read.
+	 */
+	bool open(const char* filePath);
+
+	/**
+	 * Release the mapping. data() is invalid afterwards.
+	 */
+	void close();
+
+	const uint8_t* data() const;
+	size_t size() const;
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	void* mapping;
+	size_t length;
+	std::vector<uint8_t> buffer;
+};
+
+#endif /* UTIL_MAPPEDFILE_H_ */
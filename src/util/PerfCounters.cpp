@@ -0,0 +1,186 @@
+/*
+ * PerfCounters.cpp
+ *
+ */
+
+#include "PerfCounters.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+const char *eventNames[PerfCounters::NumEvents] = {"cycles", "instructions", "branch-misses", "cache-misses"};
+
+struct PhaseTotals
+{
+	unsigned long long counts[PerfCounters::NumEvents];
+	long long bytes;
+	int calls;
+};
+
+struct Snapshot
+{
+	unsigned long long counts[PerfCounters::NumEvents];
+	unsigned long long timeEnabled;
+	unsigned long long timeRunning;
+};
+
+bool enabled = false;
+// The counters only see the thread that opened them; phases on other threads are ignored.
+std::thread::id ownerThread;
+// File descriptor of each event, -1 for events the CPU does not support.
+int eventFds[PerfCounters::NumEvents] = {-1, -1, -1, -1};
+std::map<std::string, Snapshot> openPhases;
+std::map<std::string, PhaseTotals> phaseTotals;
+std::vector<std::string> phaseOrder;
+
+#if defined(__linux__)
+int openEvent(unsigned long long config, int groupFd)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = (groupFd == -1);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+/**
+ * Read all counters of the group with a single system call.
+ */
+bool readSnapshot(Snapshot &snapshot)
+{
+	unsigned long long buffer[3 + PerfCounters::NumEvents];
+	if (read(eventFds[PerfCounters::Cycles], buffer, sizeof(buffer)) < (ssize_t)(3 * sizeof(unsigned long long)))
+		return false;
+
+	snapshot.timeEnabled = buffer[1];
+	snapshot.timeRunning = buffer[2];
+	unsigned long long value = 0;
+	for (int e = 0; e < PerfCounters::NumEvents; ++e)
+	{
+		snapshot.counts[e] = 0;
+		if (eventFds[e] != -1 && value < buffer[0])
+			snapshot.counts[e] = buffer[3 + value++];
+	}
+	return true;
+}
+#endif
+
+}
+
+bool PerfCounters::enable()
+{
+#if defined(__linux__)
+	if (enabled)
+		return true;
+
+	static const unsigned long long configs[NumEvents] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES};
+
+	eventFds[Cycles] = openEvent(configs[Cycles], -1);
+	if (eventFds[Cycles] == -1)
+		return false;
+	for (int e = Cycles + 1; e < NumEvents; ++e)
+		eventFds[e] = openEvent(configs[e], eventFds[Cycles]);
+
+	ioctl(eventFds[Cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(eventFds[Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	ownerThread = std::this_thread::get_id();
+	enabled = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool PerfCounters::isEnabled()
+{
+	return enabled;
+}
+
+void PerfCounters::beginPhase(const char *phaseName)
+{
+#if defined(__linux__)
+	if (!enabled || std::this_thread::get_id() != ownerThread)
+		return;
+	Snapshot snapshot;
+	if (readSnapshot(snapshot))
+		openPhases[phaseName] = snapshot;
+#endif
+}
+
+void PerfCounters::endPhase(const char *phaseName, long long bytesProcessed)
+{
+#if defined(__linux__)
+	if (!enabled || std::this_thread::get_id() != ownerThread)
+		return;
+	Snapshot end;
+	std::map<std::string, Snapshot>::iterator start = openPhases.find(phaseName);
+	if (start == openPhases.end() || !readSnapshot(end))
+		return;
+
+	// Scale for multiplexing when the PMU could not keep the whole group scheduled.
+	unsigned long long enabledDelta = end.timeEnabled - start->second.timeEnabled;
+	unsigned long long runningDelta = end.timeRunning - start->second.timeRunning;
+	double scale = (runningDelta > 0) ? (double)enabledDelta / runningDelta : 1.0;
+
+	if (phaseTotals.find(phaseName) == phaseTotals.end())
+	{
+		phaseOrder.push_back(phaseName);
+		memset(&phaseTotals[phaseName], 0, sizeof(PhaseTotals));
+	}
+	PhaseTotals &totals = phaseTotals[phaseName];
+	for (int e = 0; e < NumEvents; ++e)
+		totals.counts[e] += (unsigned long long)((end.counts[e] - start->second.counts[e]) * scale);
+	totals.bytes += bytesProcessed;
+	totals.calls++;
+	openPhases.erase(start);
+#endif
+}
+
+void PerfCounters::printReport()
+{
+	if (!enabled)
+	{
+		printf("perf counters: unavailable (perf_event_open failed or not supported)\n");
+		return;
+	}
+
+	printf("%-12s %8s %12s", "phase", "calls", "bytes");
+	for (int e = 0; e < NumEvents; ++e)
+		printf(" %16s %10s", eventNames[e], "/byte");
+	printf(" %6s\n", "IPC");
+
+	for (size_t p = 0; p < phaseOrder.size(); ++p)
+	{
+		const PhaseTotals &totals = phaseTotals[phaseOrder[p]];
+		printf("%-12s %8d %12lld", phaseOrder[p].c_str(), totals.calls, totals.bytes);
+		for (int e = 0; e < NumEvents; ++e)
+		{
+			if (eventFds[e] == -1)
+				printf(" %16s %10s", "n/a", "n/a");
+			else
+				printf(" %16llu %10.4f", totals.counts[e], totals.bytes > 0 ? (double)totals.counts[e] / totals.bytes : 0.0);
+		}
+		printf(" %6.2f\n", totals.counts[Cycles] > 0 ? (double)totals.counts[Instructions] / totals.counts[Cycles] : 0.0);
+	}
+}
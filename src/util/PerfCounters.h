@@ -0,0 +1,58 @@
+/*
+ * PerfCounters.h
+ *
+ * Hardware performance counters (cycles, instructions, branch misses and
+ * cache misses) collected per named codec phase through perf_event_open.
+ * Collection is off until enable() is called; on systems without
+ * perf_event_open every function is a no-op.
+ */
+
+#ifndef UTIL_PERFCOUNTERS_H_
+#define UTIL_PERFCOUNTERS_H_
+
+#include <stddef.h>
+
+class PerfCounters{
+
+public:
+	enum Event
+	{
+		Cycles = 0,
+		Instructions,
+		BranchMisses,
+		CacheMisses,
+		NumEvents
+	};
+
+	/**
+	 * Open the counters for the calling thread. Returns false, and leaves collection
+	 * disabled, if the hardware counters are not accessible.
+	 */
+	static bool enable();
+
+	/**
+	 * Returns true if enable() succeeded.
+	 */
+	static bool isEnabled();
+
+	/**
+	 * Start counting for the named phase. Phases with the same name are accumulated.
+	 * Calls from threads other than the one that called enable() are ignored.
+	 * \param[in] phaseName Name of the phase, e.g. "histogram" or "decode".
+	 */
+	static void beginPhase(const char* phaseName);
+
+	/**
+	 * Stop counting for the named phase.
+	 * \param[in] phaseName Name passed to the matching beginPhase call.
+	 * \param[in] bytesProcessed Number of input bytes handled during the phase.
+	 */
+	static void endPhase(const char* phaseName, long long bytesProcessed);
+
+	/**
+	 * Print the accumulated counters of every phase, in total and per byte processed.
+	 */
+	static void printReport();
+};
+
+#endif /* UTIL_PERFCOUNTERS_H_ */
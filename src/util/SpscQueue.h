@@ -0,0 +1,174 @@
+/*
+ * SpscQueue.h
+ *
+ * Bounded lock-free queue for exactly one producer thread and one consumer
+ * thread. The producer only writes tail and the consumer only writes head,
+ * so each side needs a single acquire load and a single release store.
+ * push and pop spin briefly on a full or empty queue and then sleep on a
+ * condition variable, so a stage waiting on slow storage does not hold a core.
+ */
+
+#ifndef UTIL_SPSCQUEUE_H_
+#define UTIL_SPSCQUEUE_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+template <typename T>
+class SpscQueue{
+
+public:
+	/**
+	 * \param[in] capacity Maximum number of queued items, rounded up to a power of two.
+	 */
+	explicit SpscQueue(size_t capacity) : sleepers(0), head(0), tail(0)
+	{
+		size_t size = 1;
+		while (size < capacity)
+			size *= 2;
+		items.resize(size);
+		mask = size - 1;
+	}
+
+	/**
+	 * Producer side. Returns false if the queue is full.
+	 */
+	bool tryPush(const T& item)
+	{
+		if (!insert(item))
+			return false;
+		wakeSleepers();
+		return true;
+	}
+
+	/**
+	 * Consumer side. Returns false if the queue is empty.
+	 */
+	bool tryPop(T& item)
+	{
+		if (!remove(item))
+			return false;
+		wakeSleepers();
+		return true;
+	}
+
+	/**
+	 * Producer side. Waits while the queue is full. Returns false if abort was set
+	 * before the item could be queued.
+	 */
+	bool push(const T& item, const std::atomic<bool>& abort)
+	{
+		return wait([&]() { return insert(item); }, abort);
+	}
+
+	/**
+	 * Consumer side. Waits while the queue is empty. Returns false if abort was set
+	 * before an item arrived.
+	 */
+	bool pop(T& item, const std::atomic<bool>& abort)
+	{
+		return wait([&]() { return remove(item); }, abort);
+	}
+
+private:
+	SpscQueue(const SpscQueue&);
+	SpscQueue& operator=(const SpscQueue&);
+
+	// Attempts before a waiting side goes to sleep.
+	static const int SPIN_COUNT = 64;
+	// Nobody signals abort, so sleepers check it this often.
+	static const int ABORT_CHECK_INTERVAL_MS = 10;
+
+	bool insert(const T& item)
+	{
+		size_t currentTail = tail.load(std::memory_order_relaxed);
+		if (currentTail - head.load(std::memory_order_acquire) == items.size())
+			return false;
+		items[currentTail & mask] = item;
+		tail.store(currentTail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool remove(T& item)
+	{
+		size_t currentHead = head.load(std::memory_order_relaxed);
+		if (currentHead == tail.load(std::memory_order_acquire))
+			return false;
+		item = items[currentHead & mask];
+		head.store(currentHead + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Call attempt, insert or remove, until it succeeds or abort is set, spinning first
+	 * and then sleeping until the other side changes the queue. Wakes the other side
+	 * after a successful attempt.
+	 */
+	template <typename Attempt>
+	bool wait(Attempt attempt, const std::atomic<bool>& abort)
+	{
+		for (int spin = 0; spin < SPIN_COUNT; ++spin)
+		{
+			if (attempt())
+			{
+				wakeSleepers();
+				return true;
+			}
+			if (abort.load(std::memory_order_relaxed))
+				return false;
+			std::this_thread::yield();
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		while (true)
+		{
+			// Announce the sleeper before the last attempt. wakeSleepers stores before
+			// it loads sleepers, so either the attempt sees the other side's change or
+			// the other side sees the sleeper and notifies under the mutex.
+			sleepers.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			bool done = attempt();
+			if (!done && !abort.load(std::memory_order_relaxed))
+				wakeUp.wait_for(lock, std::chrono::milliseconds(ABORT_CHECK_INTERVAL_MS));
+			sleepers.fetch_sub(1, std::memory_order_relaxed);
+			if (done)
+			{
+				lock.unlock();
+				wakeSleepers();
+				return true;
+			}
+			if (abort.load(std::memory_order_relaxed))
+				return false;
+		}
+	}
+
+	void wakeSleepers()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleepers.load(std::memory_order_relaxed) == 0)
+			return;
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		wakeUp.notify_all();
+	}
+
+	std::vector<T> items;
+	size_t mask;
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+	std::atomic<int> sleepers;
+	// Kept on separate cache lines so producer and consumer do not false share.
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+};
+
+template <typename T>
+const int SpscQueue<T>::SPIN_COUNT;
+template <typename T>
+const int SpscQueue<T>::ABORT_CHECK_INTERVAL_MS;
+
+#endif /* UTIL_SPSCQUEUE_H_ */
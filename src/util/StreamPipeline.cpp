@@ -0,0 +1,105 @@
+/*
+ * StreamPipeline.cpp
+ *
+ */
+
+#include "StreamPipeline.h"
+#include "AsyncFileIO.h"
+#include "SpscQueue.h"
+
+#include <atomic>
+#include <thread>
+
+namespace
+{
+
+struct PipelineBuffer
+{
+	std::vector<uint8_t> data;
+	size_t length;
+};
+
+}
+
+const size_t StreamPipeline::DEFAULT_CHUNK_SIZE;
+const int StreamPipeline::DEFAULT_DEPTH;
+
+bool StreamPipeline::run(FILE *inputFile, FILE *outputFile, const Transform &transform, size_t chunkSize, int depth)
+{
+	// Buffers circulate reader -> transform -> reader and transform -> writer -> transform.
+	// Every queue has exactly one producer and one consumer thread. A NULL buffer marks
+	// the end of the stream.
+	std::vector<PipelineBuffer> inputBuffers(depth), outputBuffers(depth);
+	SpscQueue<PipelineBuffer *> freeInput(depth), filledInput(depth + 1);
+	SpscQueue<PipelineBuffer *> freeOutput(depth), filledOutput(depth + 1);
+	for (int i = 0; i < depth; ++i)
+	{
+		inputBuffers[i].data.resize(chunkSize);
+		freeInput.tryPush(&inputBuffers[i]);
+		freeOutput.tryPush(&outputBuffers[i]);
+	}
+
+	std::atomic<bool> abort(false);
+	std::atomic<bool> readFailed(false), writeFailed(false);
+
+	std::thread reader([&]()
+	{
+		AsyncFileReader fileReader(inputFile, chunkSize, depth);
+		PipelineBuffer *buffer;
+		while (freeInput.pop(buffer, abort))
+		{
+			long length = fileReader.read(buffer->data.data());
+			if (length <= 0)
+			{
+				readFailed = length < 0;
+				filledInput.push(NULL, abort);
+				return;
+			}
+			buffer->length = length;
+			if (!filledInput.push(buffer, abort))
+				return;
+		}
+	});
+
+	std::thread writer([&]()
+	{
+		AsyncFileWriter fileWriter(outputFile, chunkSize, depth);
+		PipelineBuffer *buffer;
+		while (filledOutput.pop(buffer, abort) && buffer != NULL)
+		{
+			if (!fileWriter.write(buffer->data.data(), buffer->length))
+			{
+				writeFailed = true;
+				abort = true;
+				return;
+			}
+			if (!freeOutput.push(buffer, abort))
+				return;
+		}
+		if (!fileWriter.finish())
+			writeFailed = true;
+	});
+
+	bool transformed = true;
+	PipelineBuffer *input, *output;
+	while (filledInput.pop(input, abort) && input != NULL)
+	{
+		if (!freeOutput.pop(output, abort))
+			break;
+		output->data.clear();
+		if (!transform(input->data.data(), input->length, output->data))
+		{
+			transformed = false;
+			abort = true;
+			break;
+		}
+		output->length = output->data.size();
+		freeInput.push(input, abort);
+		filledOutput.push(output, abort);
+	}
+	filledOutput.push(NULL, abort);
+
+	reader.join();
+	writer.join();
+	return transformed && !readFailed && !writeFailed;
+}
@@ -0,0 +1,45 @@
+/*
+ * StreamPipeline.h
+ *
+ * Three stage file transform: a reader thread, the calling thread running the
+ * transform, and a writer thread. Stages hand large buffers to each other over
+ * bounded SpscQueues and return them for reuse, so reading, transforming and
+ * writing overlap instead of running one after another. File I/O goes through
+ * AsyncFileReader and AsyncFileWriter, i.e. io_uring where available.
+ */
+
+#ifndef UTIL_STREAMPIPELINE_H_
+#define UTIL_STREAMPIPELINE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <functional>
+#include <vector>
+
+class StreamPipeline{
+
+public:
+	/**
+	 * Transform one chunk of input. Output is appended to out, which arrives empty.
+	 * Chunks are passed in file order. Returns false to stop the pipeline.
+	 */
+	typedef std::function<bool(const uint8_t* data, size_t length, std::vector<uint8_t>& out)> Transform;
+
+	static const size_t DEFAULT_CHUNK_SIZE = 1 << 20;
+	static const int DEFAULT_DEPTH = 4;
+
+	/**
+	 * Read inputFile in chunks, transform every chunk and write the results to outputFile.
+	 *
+	 * \param[in] inputFile File to read from its current position to the end.
+	 * \param[in] outputFile File the transformed chunks are written to.
+	 * \param[in] transform Called on the calling thread for every chunk.
+	 * \param[in] chunkSize Number of bytes read per chunk.
+	 * \param[in] depth Number of buffers in flight between two stages.
+	 * \param[out] bool false if reading, writing or the transform failed.
+	 */
+	static bool run(FILE* inputFile, FILE* outputFile, const Transform& transform,
+					size_t chunkSize = DEFAULT_CHUNK_SIZE, int depth = DEFAULT_DEPTH);
+};
+
+#endif /* UTIL_STREAMPIPELINE_H_ */